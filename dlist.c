@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "dlist.h"
+
+#define INIT_CMDS_CAPACITY 256
+#define INIT_POOL_CAPACITY 1024
+#define INIT_TEXT_CAPACITY 256
+#define INIT_SPRITES_CAPACITY 64
+
+// how many buckets back dl_sort_by_state() looks for a matching state
+#define SORT_LOOKBACK 32
+
+static void *grow(void *p, int *capacity, int needed, size_t elem_size, int init_capacity) {
+	int new_capacity = (*capacity > 0) ? *capacity : init_capacity;
+	while(new_capacity < needed) {
+		new_capacity *= 2;
+	}
+	p = realloc(p, new_capacity * elem_size);
+	if(p == NULL) {
+		fprintf(stderr, "Error expanding display list!\n");
+		exit(-1);
+	}
+	*capacity = new_capacity;
+	return p;
+}
+
+void dl_init(dlist_t *dl) {
+	memset(dl, 0, sizeof(dlist_t));
+}
+
+void dl_destroy(dlist_t *dl) {
+	free(dl->cmds);
+	free(dl->pool);
+	free(dl->text);
+	free(dl->sprites);
+	free(dl->scratch);
+	free(dl->counts);
+	free(dl->sorted);
+	free(dl->buckets);
+	free(dl->next);
+	dl_init(dl);
+}
+
+/* Forget all commands but keep the buffers, so re-recording a frame of
+ * similar size doesn't allocate. */
+void dl_clear(dlist_t *dl) {
+	dl->num_cmds = 0;
+	dl->pool_used = 0;
+	dl->text_used = 0;
+	dl->sprites_used = 0;
+	dl->color_set = 0;
+	dl->line_width_set = 0;
+}
+
+static dl_cmd_t *dl_push(dlist_t *dl, int op) {
+	if(dl->num_cmds >= dl->cmds_capacity) {
+		dl->cmds = grow(dl->cmds, &dl->cmds_capacity, dl->num_cmds + 1,
+			sizeof(dl_cmd_t), INIT_CMDS_CAPACITY);
+	}
+	dl_cmd_t *c = &dl->cmds[dl->num_cmds++];
+	c->op = op;
+	c->count = 0;
+	c->first = 0;
+	return c;
+}
+
+static dl_cmd_t *dl_push4(dlist_t *dl, int op, float a0, float a1, float a2, float a3) {
+	dl_cmd_t *c = dl_push(dl, op);
+	c->a[0] = a0;
+	c->a[1] = a1;
+	c->a[2] = a2;
+	c->a[3] = a3;
+	return c;
+}
+
+void dl_set_color(dlist_t *dl, float r, float g, float b) {
+	if(dl->color_set && dl->color[0] == r && dl->color[1] == g && dl->color[2] == b) {
+		return;
+	}
+	dl->color[0] = r;
+	dl->color[1] = g;
+	dl->color[2] = b;
+	dl->color_set = 1;
+	dl_push4(dl, DL_SET_COLOR, r, g, b, 0);
+}
+
+void dl_set_line_width(dlist_t *dl, float w) {
+	if(dl->line_width_set && dl->line_width == w) {
+		return;
+	}
+	dl->line_width = w;
+	dl->line_width_set = 1;
+	dl_push4(dl, DL_SET_LINE_WIDTH, w, 0, 0, 0);
+}
+
+void dl_line(dlist_t *dl, float x1, float y1, float x2, float y2) {
+	dl_push4(dl, DL_LINE, x1, y1, x2, y2);
+}
+
+void dl_circle_outline(dlist_t *dl, float x_c, float y_c, float radius) {
+	dl_push4(dl, DL_CIRCLE_OUTLINE, x_c, y_c, radius, 0);
+}
+
+void dl_circle_filled(dlist_t *dl, float x_c, float y_c, float radius) {
+	dl_push4(dl, DL_CIRCLE_FILLED, x_c, y_c, radius, 0);
+}
+
+void dl_point(dlist_t *dl, float x, float y) {
+	dl_push4(dl, DL_POINT, x, y, 0, 0);
+}
+
+void dl_rectangle_outline(dlist_t *dl, float x1, float y1, float x2, float y2) {
+	dl_push4(dl, DL_RECTANGLE_OUTLINE, x1, y1, x2, y2);
+}
+
+void dl_rectangle_filled(dlist_t *dl, float x1, float y1, float x2, float y2) {
+	dl_push4(dl, DL_RECTANGLE_FILLED, x1, y1, x2, y2);
+}
+
+float *dl_polygon_points(dlist_t *dl, int num_points, int filled) {
+	int needed = dl->pool_used + 2 * num_points;
+	if(needed > dl->pool_capacity) {
+		dl->pool = grow(dl->pool, &dl->pool_capacity, needed, sizeof(float), INIT_POOL_CAPACITY);
+	}
+	dl_cmd_t *c = dl_push(dl, filled ? DL_POLYGON_FILLED : DL_POLYGON_OUTLINE);
+	c->count = num_points;
+	c->first = dl->pool_used;
+	dl->pool_used = needed;
+	return &dl->pool[c->first];
+}
+
+void dl_polygon_outline(dlist_t *dl, float *x, float *y, int num_points) {
+	float *p = dl_polygon_points(dl, num_points, 0);
+	memcpy(p, x, num_points * sizeof(float));
+	memcpy(p + num_points, y, num_points * sizeof(float));
+}
+
+void dl_polygon_filled(dlist_t *dl, float *x, float *y, int num_points) {
+	float *p = dl_polygon_points(dl, num_points, 1);
+	memcpy(p, x, num_points * sizeof(float));
+	memcpy(p + num_points, y, num_points * sizeof(float));
+}
+
+void dl_text(dlist_t *dl, char *text, float font_size, float x, float y, int anchor) {
+	int len = strlen(text) + 1;
+	int needed = dl->text_used + len;
+	if(needed > dl->text_capacity) {
+		dl->text = grow(dl->text, &dl->text_capacity, needed, sizeof(char), INIT_TEXT_CAPACITY);
+	}
+	dl_cmd_t *c = dl_push4(dl, DL_TEXT, x, y, font_size, 0);
+	c->count = anchor;
+	c->first = dl->text_used;
+	memcpy(&dl->text[dl->text_used], text, len);
+	dl->text_used = needed;
+}
+
+void dl_sprite(dlist_t *dl, draw_sprite_ptr sp, float x, float y, float angle, float radius) {
+	if(dl->sprites_used >= dl->sprites_capacity) {
+		dl->sprites = grow(dl->sprites, &dl->sprites_capacity, dl->sprites_used + 1, 
+			sizeof(draw_sprite_ptr), INIT_SPRITES_CAPACITY);
+	}
+	dl_cmd_t *c = dl_push4(dl, DL_SPRITE, x, y, angle, radius);
+	c->first = dl->sprites_used;
+	dl->sprites[dl->sprites_used++] = sp;
+}
+
+static float *dl_scratch(dlist_t *dl, int num_floats) {
+	if(num_floats > dl->scratch_capacity) {
+		dl->scratch = grow(dl->scratch, &dl->scratch_capacity, num_floats, sizeof(float), INIT_POOL_CAPACITY);
+	}
+	return dl->scratch;
+}
+
+static int *dl_counts(dlist_t *dl, int num) {
+	if(num > dl->counts_capacity) {
+		dl->counts = grow(dl->counts, &dl->counts_capacity, num, sizeof(int), INIT_CMDS_CAPACITY);
+	}
+	return dl->counts;
+}
+
+// number of consecutive commands starting at index i with the same op
+static int dl_run_length(dlist_t *dl, int i) {
+	int op = dl->cmds[i].op;
+	int j = i + 1;
+	while(j < dl->num_cmds && dl->cmds[j].op == op) {
+		j++;
+	}
+	return j - i;
+}
+
+// gather inline argument k of n commands into a contiguous array
+static void dl_gather(dl_cmd_t *c, int n, int k, float *out) {
+	int i;
+	for(i=0; i < n; i++) {
+		out[i] = c[i].a[k];
+	}
+}
+
+static void dl_replay_lines(dlist_t *dl, dl_cmd_t *c, int n, draw_ptr dp) {
+	float *s = dl_scratch(dl, 4 * n);
+	dl_gather(c, n, 0, s);
+	dl_gather(c, n, 1, s + n);
+	dl_gather(c, n, 2, s + 2*n);
+	dl_gather(c, n, 3, s + 3*n);
+	draw_lines(dp, s, s + n, s + 2*n, s + 3*n, n);
+}
+
+static void dl_replay_circles(dlist_t *dl, dl_cmd_t *c, int n, draw_ptr dp) {
+	float *s = dl_scratch(dl, 3 * n);
+	dl_gather(c, n, 0, s);
+	dl_gather(c, n, 1, s + n);
+	dl_gather(c, n, 2, s + 2*n);
+	if(c->op == DL_CIRCLE_FILLED) {
+		draw_circles_filled(dp, s, s + n, s + 2*n, n);
+	} else {
+		draw_circles_outline(dp, s, s + n, s + 2*n, n);
+	}
+}
+
+static void dl_replay_points(dlist_t *dl, dl_cmd_t *c, int n, draw_ptr dp) {
+	float *s = dl_scratch(dl, 2 * n);
+	dl_gather(c, n, 0, s);
+	dl_gather(c, n, 1, s + n);
+	draw_points(dp, s, s + n, n);
+}
+
+static void dl_replay_polygons(dlist_t *dl, dl_cmd_t *c, int n, draw_ptr dp) {
+	int i;
+	int total = 0;
+	int *counts = dl_counts(dl, n);
+	for(i=0; i < n; i++) {
+		counts[i] = c[i].count;
+		total += c[i].count;
+	}
+	float *x = dl_scratch(dl, 2 * total);
+	float *y = x + total;
+	for(i=0; i < n; i++) {
+		float *p = &dl->pool[c[i].first];
+		memcpy(x, p, c[i].count * sizeof(float));
+		memcpy(y, p + c[i].count, c[i].count * sizeof(float));
+		x += c[i].count;
+		y += c[i].count;
+	}
+	x = dl->scratch;
+	y = x + total;
+	if(c->op == DL_POLYGON_FILLED) {
+		draw_polygons_filled(dp, x, y, counts, n);
+	} else {
+		draw_polygons_outline(dp, x, y, counts, n);
+	}
+}
+
+void dl_replay(dlist_t *dl, draw_ptr dp) {
+	int i;
+	for(i=0; i < dl->num_cmds; i++) {
+		dl_cmd_t *c = &dl->cmds[i];
+		float *a = c->a;
+
+		int n = 1;
+		switch(c->op) {
+			case DL_LINE:
+			case DL_CIRCLE_OUTLINE:
+			case DL_CIRCLE_FILLED:
+			case DL_POLYGON_OUTLINE:
+			case DL_POLYGON_FILLED:
+			case DL_POINT:
+				n = dl_run_length(dl, i);
+				break;
+		}
+		if(n > 1 || c->op == DL_POINT) {
+			switch(c->op) {
+				case DL_LINE:
+					dl_replay_lines(dl, c, n, dp);
+					break;
+				case DL_CIRCLE_OUTLINE:
+				case DL_CIRCLE_FILLED:
+					dl_replay_circles(dl, c, n, dp);
+					break;
+				case DL_POINT:
+					dl_replay_points(dl, c, n, dp);
+					break;
+				default:
+					dl_replay_polygons(dl, c, n, dp);
+			}
+			i += n - 1;
+			continue;
+		}
+
+		switch(c->op) {
+			case DL_SET_COLOR:
+				draw_set_color(dp, a[0], a[1], a[2]);
+				break;
+			case DL_SET_LINE_WIDTH:
+				draw_set_line_width(dp, a[0]);
+				break;
+			case DL_LINE:
+				draw_line(dp, a[0], a[1], a[2], a[3]);
+				break;
+			case DL_CIRCLE_OUTLINE:
+				draw_circle_outline(dp, a[0], a[1], a[2]);
+				break;
+			case DL_CIRCLE_FILLED:
+				draw_circle_filled(dp, a[0], a[1], a[2]);
+				break;
+			case DL_RECTANGLE_OUTLINE:
+				draw_rectangle_outline(dp, a[0], a[1], a[2], a[3]);
+				break;
+			case DL_RECTANGLE_FILLED:
+				draw_rectangle_filled(dp, a[0], a[1], a[2], a[3]);
+				break;
+			case DL_POLYGON_OUTLINE: {
+				float *p = &dl->pool[c->first];
+				draw_polygon_outline(dp, p, p + c->count, c->count);
+				break;
+			}
+			case DL_POLYGON_FILLED: {
+				float *p = &dl->pool[c->first];
+				draw_polygon_filled(dp, p, p + c->count, c->count);
+				break;
+			}
+			case DL_TEXT:
+				draw_text(dp, &dl->text[c->first], a[2], a[0], a[1], c->count);
+				break;
+			case DL_SPRITE:
+				draw_sprite_blit(dp, dl->sprites[c->first], a[0], a[1], a[2]);
+				break;
+			default:
+				assert(0);
+		}
+	}
+}
+
+/* Sorting *************************************************************/
+
+typedef struct {
+	int op;
+	float color[3];
+	float line_width; // 0 for fills, where it doesn't matter
+	float bb[4];      // x_min, y_min, x_max, y_max of everything in the bucket
+	int first;        // first and last command index (linked through dl->next)
+	int last;
+} dl_bucket_t;
+
+static int dl_is_fill(int op) {
+	return op == DL_CIRCLE_FILLED || op == DL_RECTANGLE_FILLED || op == DL_POLYGON_FILLED ||
+		op == DL_POINT || op == DL_SPRITE;
+}
+
+static float min2(float a, float b) { return a < b ? a : b; }
+static float max2(float a, float b) { return a > b ? a : b; }
+
+/* Pixel bounding box of a primitive, padded for the line width.  Returns 0
+ * if the extent is unknown (text), in which case the command must not be
+ * reordered past anything. */
+static int dl_cmd_bbox(dlist_t *dl, dl_cmd_t *c, float line_width, float bb[4]) {
+	float *a = c->a;
+	float pad = dl_is_fill(c->op) ? 1 : (line_width / 2 + 1);
+	if(c->op == DL_POLYGON_OUTLINE) {
+		pad = line_width / 2 * DRAW_MITER_LIMIT + 1; // sharp corners stick out that far
+	}
+	switch(c->op) {
+		case DL_LINE:
+		case DL_RECTANGLE_OUTLINE:
+		case DL_RECTANGLE_FILLED:
+			bb[0] = min2(a[0], a[2]);
+			bb[1] = min2(a[1], a[3]);
+			bb[2] = max2(a[0], a[2]);
+			bb[3] = max2(a[1], a[3]);
+			break;
+		case DL_CIRCLE_OUTLINE:
+		case DL_CIRCLE_FILLED:
+			bb[0] = a[0] - a[2];
+			bb[1] = a[1] - a[2];
+			bb[2] = a[0] + a[2];
+			bb[3] = a[1] + a[2];
+			break;
+		case DL_POINT:
+			bb[0] = bb[2] = a[0];
+			bb[1] = bb[3] = a[1];
+			break;
+		case DL_SPRITE:
+			bb[0] = a[0] - a[3];
+			bb[1] = a[1] - a[3];
+			bb[2] = a[0] + a[3];
+			bb[3] = a[1] + a[3];
+			break;
+		case DL_POLYGON_OUTLINE:
+		case DL_POLYGON_FILLED: {
+			int i;
+			float *x = &dl->pool[c->first];
+			float *y = x + c->count;
+			bb[0] = bb[2] = x[0];
+			bb[1] = bb[3] = y[0];
+			for(i=1; i < c->count; i++) {
+				bb[0] = min2(bb[0], x[i]);
+				bb[1] = min2(bb[1], y[i]);
+				bb[2] = max2(bb[2], x[i]);
+				bb[3] = max2(bb[3], y[i]);
+			}
+			break;
+		}
+		default:
+			return 0;
+	}
+	bb[0] -= pad;
+	bb[1] -= pad;
+	bb[2] += pad;
+	bb[3] += pad;
+	return 1;
+}
+
+static int bb_overlap(const float a[4], const float b[4]) {
+	return a[0] <= b[2] && b[0] <= a[2] && a[1] <= b[3] && b[1] <= a[3];
+}
+
+void dl_sort_by_state(dlist_t *dl) {
+	int i;
+	int num_buckets = 0;
+	float color[3] = {0, 0, 0};
+	float line_width = 1;
+
+	if(dl->num_cmds > dl->next_capacity) {
+		dl->next = grow(dl->next, &dl->next_capacity, dl->num_cmds, sizeof(int), INIT_CMDS_CAPACITY);
+	}
+
+	/* Walk the list tracking the current state, and drop each primitive
+	 * into the most recent bucket with the same state that it can legally
+	 * move back to. */
+	for(i=0; i < dl->num_cmds; i++) {
+		dl_cmd_t *c = &dl->cmds[i];
+		if(c->op == DL_SET_COLOR) {
+			memcpy(color, c->a, sizeof(color));
+			continue;
+		}
+		if(c->op == DL_SET_LINE_WIDTH) {
+			line_width = c->a[0];
+			continue;
+		}
+		dl->next[i] = -1;
+
+		float key_width = dl_is_fill(c->op) ? 0 : line_width;
+		float bb[4] = {0, 0, 0, 0};
+		int movable = dl_cmd_bbox(dl, c, line_width, bb);
+
+		dl_bucket_t *buckets = (dl_bucket_t *)dl->buckets;
+		dl_bucket_t *b = NULL;
+		int j;
+		for(j = num_buckets - 1; movable && j >= 0 && j >= num_buckets - SORT_LOOKBACK; j--) {
+			dl_bucket_t *cand = &buckets[j];
+			if(cand->op == c->op && cand->line_width == key_width &&
+				!memcmp(cand->color, color, sizeof(color))) {
+				b = cand;
+				break;
+			}
+			if(cand->op == DL_TEXT || bb_overlap(cand->bb, bb)) {
+				break;
+			}
+		}
+
+		if(b == NULL) {
+			if(num_buckets >= dl->buckets_capacity) {
+				dl->buckets = grow(dl->buckets, &dl->buckets_capacity, num_buckets + 1, 
+					sizeof(dl_bucket_t), INIT_CMDS_CAPACITY);
+				buckets = (dl_bucket_t *)dl->buckets;
+			}
+			b = &buckets[num_buckets++];
+			b->op = c->op; // text (the only unmovable op) also acts as a barrier
+			memcpy(b->color, color, sizeof(color));
+			b->line_width = key_width;
+			memcpy(b->bb, bb, sizeof(bb));
+			b->first = i;
+			b->last = i;
+		}
+		else {
+			b->bb[0] = min2(b->bb[0], bb[0]);
+			b->bb[1] = min2(b->bb[1], bb[1]);
+			b->bb[2] = max2(b->bb[2], bb[2]);
+			b->bb[3] = max2(b->bb[3], bb[3]);
+			dl->next[b->last] = i;
+			b->last = i;
+		}
+	}
+
+	/* Re-emit the commands bucket by bucket, with one state change (at
+	 * most) in front of each bucket. */
+	int max_cmds = dl->num_cmds + 2 * num_buckets;
+	if(max_cmds > dl->sorted_capacity) {
+		dl->sorted = grow(dl->sorted, &dl->sorted_capacity, max_cmds, sizeof(dl_cmd_t), INIT_CMDS_CAPACITY);
+	}
+	dl_bucket_t *buckets = (dl_bucket_t *)dl->buckets;
+	dl_cmd_t *out = dl->sorted;
+	int n = 0;
+	int have_color = 0;
+	int have_width = 0;
+	for(i=0; i < num_buckets; i++) {
+		dl_bucket_t *b = &buckets[i];
+		if(!have_color || memcmp(color, b->color, sizeof(color))) {
+			memcpy(color, b->color, sizeof(color));
+			out[n].op = DL_SET_COLOR;
+			memcpy(out[n].a, color, sizeof(color));
+			n++;
+			have_color = 1;
+		}
+		// fills don't depend on the line width, so they don't need to set it
+		if(b->line_width != 0 && (!have_width || line_width != b->line_width)) {
+			line_width = b->line_width;
+			out[n].op = DL_SET_LINE_WIDTH;
+			out[n].a[0] = line_width;
+			n++;
+			have_width = 1;
+		}
+		int k;
+		for(k = b->first; k >= 0; k = dl->next[k]) {
+			out[n++] = dl->cmds[k];
+		}
+	}
+
+	// swap the sorted commands in
+	dl_cmd_t *tmp = dl->cmds;
+	int tmp_capacity = dl->cmds_capacity;
+	dl->cmds = dl->sorted;
+	dl->cmds_capacity = dl->sorted_capacity;
+	dl->num_cmds = n;
+	dl->sorted = tmp;
+	dl->sorted_capacity = tmp_capacity;
+
+	// the recorded state no longer matches the tail of the list
+	dl->color_set = 0;
+	dl->line_width_set = 0;
+}
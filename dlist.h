@@ -0,0 +1,110 @@
+#ifndef __DLIST_H__
+#define __DLIST_H__
+
+#include "draw.h"
+
+/* A display list records draw.h calls into a reusable buffer so a frame
+ * can be evaluated once and then replayed (possibly many times) on any
+ * backend. */
+
+typedef enum {
+  DL_SET_COLOR,
+  DL_SET_LINE_WIDTH,
+  DL_LINE,
+  DL_CIRCLE_OUTLINE,
+  DL_CIRCLE_FILLED,
+  DL_RECTANGLE_OUTLINE,
+  DL_RECTANGLE_FILLED,
+  DL_POLYGON_OUTLINE,
+  DL_POLYGON_FILLED,
+  DL_POINT,
+  DL_TEXT,
+  DL_SPRITE
+} dl_op_enum;
+
+typedef struct {
+  int op;
+  int count;  // polygon: number of points; text: anchor
+  int first;  // polygon: index into the point pool; text: index into the text pool; sprite: index into sprites
+  float a[4]; // inline arguments (color, width, line end points, circle, rectangle, text pos/size, sprite pos/angle/radius)
+} dl_cmd_t;
+
+typedef struct {
+  dl_cmd_t *cmds;
+  int num_cmds;
+  int cmds_capacity;
+
+  float *pool;
+  int pool_used;
+  int pool_capacity;
+
+  char *text;
+  int text_used;
+  int text_capacity;
+
+  draw_sprite_ptr *sprites;
+  int sprites_used;
+  int sprites_capacity;
+
+  // current recorded state, so redundant state changes are dropped
+  float color[3];
+  float line_width;
+  int color_set;
+  int line_width_set;
+
+  // scratch for dl_sort_by_state()
+  dl_cmd_t *sorted;
+  int sorted_capacity;
+  void *buckets;
+  int buckets_capacity;
+  int *next;
+  int next_capacity;
+
+  // replay scratch, used to gather runs of commands into batched calls
+  float *scratch;
+  int scratch_capacity;
+  int *counts;
+  int counts_capacity;
+} dlist_t;
+
+void dl_init(dlist_t *dl);
+void dl_destroy(dlist_t *dl);
+void dl_clear(dlist_t *dl);
+
+/* Replay the list on a backend.  Consecutive commands of the same kind
+ * (with no state change in between) are sent as one batched draw call. */
+void dl_replay(dlist_t *dl, draw_ptr dp);
+
+/* Reorder the recorded primitives so that ones sharing the same color,
+ * line width and kind are adjacent (and so replay as one batch with one
+ * state change).  A primitive is only moved ahead of others when their
+ * bounding boxes don't overlap, so the painted result is unchanged. */
+void dl_sort_by_state(dlist_t *dl);
+
+void dl_set_color(dlist_t *dl, float r, float g, float b);
+void dl_set_line_width(dlist_t *dl, float w);
+
+void dl_line(dlist_t *dl, float x1, float y1, float x2, float y2);
+void dl_circle_outline(dlist_t *dl, float x_c, float y_c, float radius);
+void dl_circle_filled(dlist_t *dl, float x_c, float y_c, float radius);
+
+void dl_point(dlist_t *dl, float x, float y);
+
+void dl_rectangle_outline(dlist_t *dl, float x1, float y1, float x2, float y2);
+void dl_rectangle_filled(dlist_t *dl, float x1, float y1, float x2, float y2);
+
+void dl_polygon_outline(dlist_t *dl, float *x, float *y, int num_points);
+void dl_polygon_filled(dlist_t *dl, float *x, float *y, int num_points);
+
+/* Reserve room for a polygon and return a pointer to its x coordinates (the
+ * y coordinates follow at x + num_points).  The caller fills them in place;
+ * the pointer is only valid until the next dl_* call. */
+float *dl_polygon_points(dlist_t *dl, int num_points, int filled);
+
+void dl_text(dlist_t *dl, char *text, float font_size, float x, float y, int anchor);
+
+/* Blit a sprite centered on (x, y), rotated by angle (see draw_sprite_blit()).
+ * radius bounds it, for sorting.  The sprite must outlive the recording. */
+void dl_sprite(dlist_t *dl, draw_sprite_ptr sp, float x, float y, float angle, float radius);
+
+#endif
@@ -14,14 +14,53 @@ typedef enum {
 } anchor_enum;
 
 typedef void *draw_ptr;
+typedef void *draw_layer_ptr;
+typedef void *draw_sprite_ptr;
 
 draw_ptr draw_create(void *canvas);
 void draw_destroy(draw_ptr dp);
 
+/* An image drawer renders into memory instead of a widget, and needs
+ * neither GTK nor a display.  draw_create_image() returns NULL if the
+ * backend can't render offscreen.  draw_image_write_png() returns 0 on
+ * success. */
+draw_ptr draw_create_image(int width, int height);
+int draw_image_write_png(draw_ptr dp, const char *filename);
+
+/* The pixels of an image drawer after draw_finish(): rows of 32 bit
+ * 0x00RRGGBB values (native byte order), *stride_out bytes apart. */
+unsigned char *draw_image_get_data(draw_ptr dp, int *stride_out);
+
+/* Copy an image in the same format (e.g. another drawer's image data) to
+ * the canvas, with its top left corner at (x,y). */
+void draw_pixels(draw_ptr dp, unsigned char *data, int stride, int width, int height, float x, float y);
+
 void draw_start(draw_ptr); 
 void draw_finish(draw_ptr); 
 
 void draw_get_canvas_dims(draw_ptr dp, float *width_out, float *height_out);
+
+/* Limit drawing on the canvas to a rectangle (the damaged part of the
+ * window) until draw_finish().  Call right after draw_start().  Drawing
+ * into a layer isn't clipped. */
+void draw_clip(draw_ptr dp, float x, float y, float width, float height);
+
+/* Trade looks for speed, for frames that are only seen in passing:
+ * DRAW_QUALITY_FAST drops anti-aliasing and uses cheaper line caps where
+ * the backend has them.  Takes effect right away (layers included) and
+ * stays until changed.  Drawers start at DRAW_QUALITY_BEST. */
+enum {
+  DRAW_QUALITY_FAST,
+  DRAW_QUALITY_BEST
+};
+void draw_set_quality(draw_ptr dp, int quality);
+
+/* Outline corners are mitered, and beveled where the miter would reach
+ * more than this many half line widths past the corner.  X11's limit is
+ * fixed (corners sharper than 11 degrees are beveled, about 10.4), so the
+ * other backends are set to match it.  Anything sizing an outline's
+ * extent must allow for line_width/2 * DRAW_MITER_LIMIT. */
+#define DRAW_MITER_LIMIT 10.5
 float draw_get_canvas_width(draw_ptr dp);
 float draw_get_canvas_height(draw_ptr dp);
 
@@ -35,11 +74,50 @@ void draw_rectangle_filled(draw_ptr dp, float x1, float y1, float x2, float y2);
 void draw_polygon_outline(draw_ptr dp, float *x, float *y, int num_points);
 void draw_polygon_filled(draw_ptr dp, float *x, float *y, int num_points);
 
+/* Batched primitives: draw many shapes with the current color and line
+ * width in a single call.  Line i runs from (x1[i],y1[i]) to (x2[i],y2[i]).
+ * Polygon i has counts[i] points, taken consecutively from x and y. */
+void draw_lines(draw_ptr dp, float *x1, float *y1, float *x2, float *y2, int count);
+void draw_circles_outline(draw_ptr dp, float *x_c, float *y_c, float *radius, int count);
+void draw_circles_filled(draw_ptr dp, float *x_c, float *y_c, float *radius, int count);
+void draw_polygons_outline(draw_ptr dp, float *x, float *y, int *counts, int num_polygons);
+void draw_polygons_filled(draw_ptr dp, float *x, float *y, int *counts, int num_polygons);
+
+/* Single pixels centered at (x[i],y[i]), for shapes too small to draw. */
+void draw_points(draw_ptr dp, float *x, float *y, int count);
+
 void draw_set_color(draw_ptr dp, float r, float g, float b);
 void draw_set_line_width(draw_ptr dp, float w);
 
 void draw_text(draw_ptr dp, char *text, float font_size, float x, float y, int anchor);
 
+/* Layers are offscreen surfaces owned by a drawer, for content that is
+ * expensive to draw but rarely changes.  Between draw_layer_begin() and
+ * draw_layer_end() all drawing goes into the layer instead of the canvas.
+ * These must be called between draw_start() and draw_finish().
+ * draw_layer_create() returns NULL if the backend has no layer support.
+ * With the cairo and soft backends a layer can be blitted by any drawer of
+ * the same backend, not just the one that created it. */
+draw_layer_ptr draw_layer_create(draw_ptr dp, int width, int height);
+void draw_layer_destroy(draw_ptr dp, draw_layer_ptr lp);
+void draw_layer_begin(draw_ptr dp, draw_layer_ptr lp);
+void draw_layer_end(draw_ptr dp);
+void draw_layer_blit(draw_ptr dp, draw_layer_ptr lp, float x, float y);
+
+/* Sprites are small coverage masks, for shapes that are drawn many times.
+ * Whatever is drawn between draw_sprite_begin() and draw_sprite_end()
+ * becomes opaque in the sprite (the color is ignored), and can be drawn
+ * outside draw_start()/draw_finish().  draw_sprite_blit() paints the
+ * current color through the mask, centered on (x, y) and rotated by angle
+ * (radians, clockwise on screen).  Like layers, sprites can be blitted by
+ * any drawer of the same backend.  draw_sprite_create() returns NULL if
+ * the backend has no sprite support. */
+draw_sprite_ptr draw_sprite_create(draw_ptr dp, int width, int height);
+void draw_sprite_destroy(draw_ptr dp, draw_sprite_ptr sp);
+void draw_sprite_begin(draw_ptr dp, draw_sprite_ptr sp);
+void draw_sprite_end(draw_ptr dp);
+void draw_sprite_blit(draw_ptr dp, draw_sprite_ptr sp, float x, float y, float angle);
+
 void draw_get_text_dims(draw_ptr dp, char *text, float font_size, float *width_out, float *height_out);
 float draw_get_text_width(draw_ptr dp, char *text, float font_size);
 float draw_get_text_height(draw_ptr dp, char *text, float font_size);
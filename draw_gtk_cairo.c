@@ -19,9 +19,32 @@
 #define PINK   0xFF00FF
 #define PURPLE 0x800080
 
+/* Shaping a string is the expensive part of drawing text, so the glyphs
+ * and extents of each (string, font size) are kept in a small hash table
+ * and drawn with cairo_show_glyphs().  The table is emptied when it gets
+ * half full rather than evicting individual entries. */
+#define TEXT_CACHE_SLOTS 1024 // power of 2
+
+typedef struct {
+	char *text; // NULL for an empty slot
+	float font_size;
+	unsigned int hash;
+	cairo_glyph_t *glyphs; // positioned relative to the text origin
+	int num_glyphs;
+	double width;
+	double height;
+} text_layout_t;
+
 typedef struct {
 	GtkWidget *widget;
+	cairo_surface_t *image; // target of an image drawer (widget is NULL)
 	cairo_t *cr;
+	cairo_t *canvas_cr; // saved while drawing into a layer
+	cairo_t *sprite_saved_cr; // saved while drawing into a sprite (may be NULL)
+	int in_sprite;
+	text_layout_t *text_cache; // TEXT_CACHE_SLOTS entries, allocated on first use
+	int text_cache_count;
+	int quality;
 } cairo_draw_t;
 
 void *draw_create(void *canvas) {
@@ -29,38 +52,142 @@ void *draw_create(void *canvas) {
 	assert(d != NULL);
 
 	d->widget = (GtkWidget *)canvas;
+	d->image = NULL;
+	d->cr = NULL;
+	d->canvas_cr = NULL;
+	d->sprite_saved_cr = NULL;
+	d->in_sprite = 0;
+	d->text_cache = NULL;
+	d->text_cache_count = 0;
+	d->quality = DRAW_QUALITY_BEST;
 
 	return (void *)d;
 }
 
+void *draw_create_image(int width, int height) {
+	cairo_surface_t *s = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+	if(cairo_surface_status(s) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(s);
+		return NULL;
+	}
+	cairo_draw_t *d = draw_create(NULL);
+	d->image = s;
+	return (void *)d;
+}
+
+int draw_image_write_png(void *dp, const char *filename) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	assert(d->image != NULL);
+	return cairo_surface_write_to_png(d->image, filename) == CAIRO_STATUS_SUCCESS ? 0 : -1;
+}
+
+unsigned char *draw_image_get_data(void *dp, int *stride_out) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	assert(d->image != NULL);
+	cairo_surface_flush(d->image);
+	*stride_out = cairo_image_surface_get_stride(d->image);
+	return cairo_image_surface_get_data(d->image);
+}
+
+void draw_pixels(void *dp, unsigned char *data, int stride, int width, int height, float x, float y) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	cairo_surface_t *s = cairo_image_surface_create_for_data(data, CAIRO_FORMAT_RGB24, width, height, stride);
+	cairo_save(d->cr);
+	cairo_set_source_surface(d->cr, s, x, y);
+	cairo_paint(d->cr);
+	cairo_restore(d->cr);
+	cairo_surface_destroy(s);
+}
+
+static void text_cache_clear(cairo_draw_t *d) {
+	int i;
+	if(d->text_cache == NULL) {
+		return;
+	}
+	for(i=0; i < TEXT_CACHE_SLOTS; i++) {
+		text_layout_t *t = &d->text_cache[i];
+		if(t->text) {
+			free(t->text);
+			cairo_glyph_free(t->glyphs);
+			t->text = NULL;
+		}
+	}
+	d->text_cache_count = 0;
+}
+
 void draw_destroy(void *dp) {
-	free(dp);
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	if(d) {
+		text_cache_clear(d);
+		free(d->text_cache);
+	}
+	if(d && d->image) {
+		cairo_surface_destroy(d->image);
+	}
+	free(d);
+}
+
+static void apply_quality(cairo_draw_t *d) {
+	cairo_set_antialias(d->cr, 
+		(d->quality == DRAW_QUALITY_FAST) ? CAIRO_ANTIALIAS_NONE : CAIRO_ANTIALIAS_DEFAULT);
+}
+
+// called for every new context, along with apply_quality()
+static void apply_line_join(cairo_draw_t *d) {
+	cairo_set_line_join(d->cr, CAIRO_LINE_JOIN_MITER);
+	cairo_set_miter_limit(d->cr, DRAW_MITER_LIMIT);
 }
 
 void draw_start(void *dp) {
 	cairo_draw_t *d = (cairo_draw_t *)dp;
-	d->cr = gdk_cairo_create(d->widget->window);
-
+	if(d->image) {
+		d->cr = cairo_create(d->image);
+	} else {
+		d->cr = gdk_cairo_create(d->widget->window);
+	}
+	apply_quality(d);
+	apply_line_join(d);
 }
 
 void draw_finish(void *dp) {
 	cairo_draw_t *d = (cairo_draw_t *)dp;
 	cairo_destroy(d->cr);
+	d->cr = NULL;
 }
 
-void draw_get_canvas_dims(void *dp, float *width_out, float *height_out) {
+void draw_clip(void *dp, float x, float y, float width, float height) {
 	cairo_draw_t *d = (cairo_draw_t *)dp;
-	*width_out = (float)d->widget->allocation.width;
-	*height_out = (float)d->widget->allocation.height;
+	cairo_rectangle(d->cr, x, y, width, height);
+	cairo_clip(d->cr);
+}
+
+// line caps are left at cairo's default (butt), which is already the cheapest
+void draw_set_quality(void *dp, int quality) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	d->quality = quality;
+	if(d->cr) {
+		apply_quality(d);
+	}
+}
+
+void draw_get_canvas_dims(void *dp, float *width_out, float *height_out) {
+	*width_out = draw_get_canvas_width(dp);
+	*height_out = draw_get_canvas_height(dp);
 }
 
 float draw_get_canvas_width(void *dp) {
 	cairo_draw_t *d = (cairo_draw_t *)dp;
+	if(d->image) {
+		return (float)cairo_image_surface_get_width(d->image);
+	}
 	return ((float)d->widget->allocation.width);
 }
 
 float draw_get_canvas_height(void *dp) {
 	cairo_draw_t *d = (cairo_draw_t *)dp;
+	if(d->image) {
+		return (float)cairo_image_surface_get_height(d->image);
+	}
 	return ((float)d->widget->allocation.height);
 }
 
@@ -162,16 +289,244 @@ void draw_polygon_filled(void *dp, float *x, float *y, int num_points) {
 	cairo_fill(d->cr);
 }
 
-void draw_get_text_dims(void *dp, char *text, float font_size, float *width_out, float *height_out) {
+/* The batched calls build one path for the whole batch and stroke or fill
+ * it once. */
+void draw_lines(void *dp, float *x1, float *y1, float *x2, float *y2, int count) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	int i;
+	for(i=0; i < count; i++) {
+		cairo_move_to(d->cr, x1[i], y1[i]);
+		cairo_line_to(d->cr, x2[i], y2[i]);
+	}
+	cairo_stroke(d->cr);
+}
+
+static void path_circles(cairo_t *cr, float *x_c, float *y_c, float *radius, int count) {
+	int i;
+	for(i=0; i < count; i++) {
+		cairo_new_sub_path(cr);
+		cairo_arc(cr, x_c[i], y_c[i], radius[i], 0, 2*M_PI);
+	}
+}
+
+void draw_circles_outline(void *dp, float *x_c, float *y_c, float *radius, int count) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	path_circles(d->cr, x_c, y_c, radius, count);
+	cairo_stroke(d->cr);
+}
+
+void draw_circles_filled(void *dp, float *x_c, float *y_c, float *radius, int count) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	path_circles(d->cr, x_c, y_c, radius, count);
+	cairo_fill(d->cr);
+}
+
+void draw_points(void *dp, float *x, float *y, int count) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	int i;
+	for(i=0; i < count; i++) {
+		cairo_rectangle(d->cr, x[i] - 0.5, y[i] - 0.5, 1, 1);
+	}
+	cairo_fill(d->cr);
+}
+
+void draw_polygons_outline(void *dp, float *x, float *y, int *counts, int num_polygons) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	int i, j;
+	for(i=0; i < num_polygons; i++) {
+		assert(counts[i] > 1);
+		cairo_move_to(d->cr, x[0], y[0]);
+		for(j=1; j < counts[i]; j++) {
+			cairo_line_to(d->cr, x[j], y[j]);
+		}
+		x += counts[i];
+		y += counts[i];
+	}
+	cairo_stroke(d->cr);
+}
+
+void draw_polygons_filled(void *dp, float *x, float *y, int *counts, int num_polygons) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	int i, j;
+	for(i=0; i < num_polygons; i++) {
+		int n = counts[i];
+		assert(n > 1);
+		/* With the nonzero fill rule, two overlapping sub-paths of opposite
+		 * orientation would cancel out.  Add every polygon counter-clockwise
+		 * so overlaps are filled just as if each had its own cairo_fill(). */
+		float area2 = 0;
+		for(j=0; j < n; j++) {
+			int k = (j + 1) % n;
+			area2 += x[j] * y[k] - x[k] * y[j];
+		}
+		if(area2 >= 0) {
+			cairo_move_to(d->cr, x[0], y[0]);
+			for(j=1; j < n; j++) {
+				cairo_line_to(d->cr, x[j], y[j]);
+			}
+		} else {
+			cairo_move_to(d->cr, x[n-1], y[n-1]);
+			for(j=n-2; j >= 0; j--) {
+				cairo_line_to(d->cr, x[j], y[j]);
+			}
+		}
+		cairo_close_path(d->cr);
+		x += n;
+		y += n;
+	}
+	cairo_fill(d->cr);
+}
+
+void *draw_layer_create(void *dp, int width, int height) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	cairo_surface_t *s = cairo_surface_create_similar(
+		cairo_get_target(d->cr), CAIRO_CONTENT_COLOR, width, height);
+	if(cairo_surface_status(s) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(s);
+		return NULL;
+	}
+	return (void *)s;
+}
+
+void draw_layer_destroy(void *dp, void *lp) {
+	if(lp) {
+		cairo_surface_destroy((cairo_surface_t *)lp);
+	}
+}
+
+void draw_layer_begin(void *dp, void *lp) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	assert(d->canvas_cr == NULL);
+	d->canvas_cr = d->cr;
+	d->cr = cairo_create((cairo_surface_t *)lp);
+	apply_quality(d);
+	apply_line_join(d);
+}
+
+void draw_layer_end(void *dp) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	assert(d->canvas_cr != NULL);
+	cairo_destroy(d->cr);
+	d->cr = d->canvas_cr;
+	d->canvas_cr = NULL;
+}
+
+void draw_layer_blit(void *dp, void *lp, float x, float y) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	cairo_save(d->cr);
+	cairo_set_source_surface(d->cr, (cairo_surface_t *)lp, x, y);
+	cairo_paint(d->cr);
+	cairo_restore(d->cr);
+}
+
+/* Sprites are A8 image surfaces, painted with the current source through
+ * cairo_mask_surface(). */
+void *draw_sprite_create(void *dp, int width, int height) {
+	cairo_surface_t *s = cairo_image_surface_create(CAIRO_FORMAT_A8, width, height);
+	if(cairo_surface_status(s) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(s);
+		return NULL;
+	}
+	return (void *)s;
+}
+
+void draw_sprite_destroy(void *dp, void *sp) {
+	if(sp) {
+		cairo_surface_destroy((cairo_surface_t *)sp);
+	}
+}
+
+void draw_sprite_begin(void *dp, void *sp) {
 	cairo_draw_t *d = (cairo_draw_t *)dp;
-   cairo_text_extents_t te;
-   cairo_save(d->cr);
-   cairo_set_font_size(d->cr, font_size);
-   cairo_text_extents(d->cr, text, &te);
-   cairo_restore(d->cr);
+	assert(!d->in_sprite);
+	d->sprite_saved_cr = d->cr;
+	d->cr = cairo_create((cairo_surface_t *)sp);
+	d->in_sprite = 1;
+	apply_quality(d);
+	apply_line_join(d);
+}
 
-	*width_out = (float)te.width;
-	*height_out = (float)te.height;
+void draw_sprite_end(void *dp) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	assert(d->in_sprite);
+	cairo_destroy(d->cr);
+	d->cr = d->sprite_saved_cr;
+	d->sprite_saved_cr = NULL;
+	d->in_sprite = 0;
+}
+
+void draw_sprite_blit(void *dp, void *sp, float x, float y, float angle) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	cairo_surface_t *s = (cairo_surface_t *)sp;
+	cairo_save(d->cr);
+	cairo_translate(d->cr, x, y);
+	cairo_rotate(d->cr, angle);
+	cairo_mask_surface(d->cr, s, 
+		-0.5 * cairo_image_surface_get_width(s), -0.5 * cairo_image_surface_get_height(s));
+	cairo_restore(d->cr);
+}
+
+static unsigned int text_hash(const char *text, float font_size) {
+	unsigned int h = 2166136261u; // FNV-1a
+	uint32_t size_bits;
+	memcpy(&size_bits, &font_size, sizeof(size_bits));
+	for(; *text; text++) {
+		h = (h ^ (unsigned char)*text) * 16777619u;
+	}
+	return (h ^ size_bits) * 16777619u;
+}
+
+/* Look up (or shape and add) the layout of text at font_size. */
+static text_layout_t *text_layout(cairo_draw_t *d, const char *text, float font_size) {
+	if(d->text_cache == NULL) {
+		d->text_cache = calloc(TEXT_CACHE_SLOTS, sizeof(text_layout_t));
+		assert(d->text_cache != NULL);
+	}
+	unsigned int h = text_hash(text, font_size);
+	unsigned int i = h & (TEXT_CACHE_SLOTS - 1);
+	text_layout_t *t;
+	while((t = &d->text_cache[i])->text != NULL) {
+		if(t->hash == h && t->font_size == font_size && !strcmp(t->text, text)) {
+			return t;
+		}
+		i = (i + 1) & (TEXT_CACHE_SLOTS - 1);
+	}
+	if(2 * (d->text_cache_count + 1) > TEXT_CACHE_SLOTS) {
+		text_cache_clear(d);
+		i = h & (TEXT_CACHE_SLOTS - 1);
+		t = &d->text_cache[i];
+	}
+
+	t->text = malloc(strlen(text) + 1);
+	assert(t->text != NULL);
+	strcpy(t->text, text);
+	t->font_size = font_size;
+	t->hash = h;
+	t->glyphs = NULL;
+	t->num_glyphs = 0;
+
+	cairo_text_extents_t te;
+	cairo_save(d->cr);
+	cairo_set_font_size(d->cr, font_size);
+	cairo_scaled_font_t *font = cairo_get_scaled_font(d->cr);
+	if(cairo_scaled_font_text_to_glyphs(font, 0, 0, text, -1, &t->glyphs, &t->num_glyphs, 
+		NULL, NULL, NULL) != CAIRO_STATUS_SUCCESS) {
+		t->glyphs = NULL;
+		t->num_glyphs = 0;
+	}
+	cairo_scaled_font_glyph_extents(font, t->glyphs, t->num_glyphs, &te);
+	cairo_restore(d->cr);
+	t->width = te.width;
+	t->height = te.height;
+	d->text_cache_count++;
+	return t;
+}
+
+void draw_get_text_dims(void *dp, char *text, float font_size, float *width_out, float *height_out) {
+	cairo_draw_t *d = (cairo_draw_t *)dp;
+	text_layout_t *t = text_layout(d, text, font_size);
+	*width_out = (float)t->width;
+	*height_out = (float)t->height;
 }
 
 float draw_get_text_width(void *dp, char *text, float font_size) {
@@ -192,14 +547,11 @@ void draw_text(void *dp, char *text, float font_size, float x, float y, int anch
 	cairo_draw_t *d = (cairo_draw_t *)dp;
 
 	double x_left, y_bottom;
-	cairo_text_extents_t te;
 	double w, h;
 
-	cairo_save(d->cr);
-
-	cairo_text_extents(d->cr, text, &te);
-	w = te.width;
-	h = te.height;
+	text_layout_t *t = text_layout(d, text, font_size);
+	w = t->width;
+	h = t->height;
 	switch(anchor) {
 		case ANCHOR_TOP_LEFT:
 			x_left = x;
@@ -241,8 +593,10 @@ void draw_text(void *dp, char *text, float font_size, float x, float y, int anch
 			x_left = x;
 			y_bottom = y;
 	}
-	cairo_move_to(d->cr, x_left, y_bottom);
-	cairo_show_text(d->cr, text);
+	cairo_save(d->cr);
+	cairo_set_font_size(d->cr, font_size);
+	cairo_translate(d->cr, x_left, y_bottom);
+	cairo_show_glyphs(d->cr, t->glyphs, t->num_glyphs);
 	cairo_restore(d->cr);
 }
 
@@ -11,8 +11,12 @@
 #include <X11/Xos.h>
 #include <X11/Xatom.h>
 #include <X11/keysym.h>
+#include <X11/extensions/XShm.h>
 #include <gdk/gdkx.h>
 
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
 #include "draw.h"
 
 #define BLACK  0x000000
@@ -28,17 +32,60 @@
 typedef struct {
 	int width;
 	int style;
+	int cap;
 } line_attribs_t;
 
 typedef struct {
 	GtkWidget *widget;
 	Display *xdisp;
 	Window xwin;
+	Drawable canvas; // back buffer, or xwin when there is none
+	Drawable target; // canvas, or a layer's pixmap between draw_layer_begin/end
 	GC gc;
+
+	/* Back buffer in a shared memory pixmap.  Frames are drawn into it and
+	 * presented with one XCopyArea in draw_finish().  Without MIT-SHM
+	 * (e.g. a remote display) back is None and we draw to the window. */
+	int shm_available; // -1 until checked
+	XShmSegmentInfo shm;
+	Pixmap back;
+	int back_width;
+	int back_height;
+	XRectangle clip; // set on gc while drawing on the canvas, if clipped
+	int clipped;
 	uint32_t color;
 	line_attribs_t line_attribs;
+
+	// scratch buffers for converting float coordinates into X structs
+	XPoint *points;
+	int points_capacity;
+	XSegment *segments;
+	int segments_capacity;
+	XArc *arcs;
+	int arcs_capacity;
 } x_draw_t;
 
+static void *scratch_reserve(void *buf, int *capacity, int needed, size_t elem_size) {
+	if(needed <= *capacity) {
+		return buf;
+	}
+	int new_capacity = (*capacity > 0) ? *capacity : 64;
+	while(new_capacity < needed) {
+		new_capacity *= 2;
+	}
+	buf = realloc(buf, new_capacity * elem_size);
+	assert(buf != NULL);
+	*capacity = new_capacity;
+	return buf;
+}
+
+#define RESERVE_POINTS(d, n) \
+	((d)->points = scratch_reserve((d)->points, &(d)->points_capacity, (n), sizeof(XPoint)))
+#define RESERVE_SEGMENTS(d, n) \
+	((d)->segments = scratch_reserve((d)->segments, &(d)->segments_capacity, (n), sizeof(XSegment)))
+#define RESERVE_ARCS(d, n) \
+	((d)->arcs = scratch_reserve((d)->arcs, &(d)->arcs_capacity, (n), sizeof(XArc)))
+
 void *draw_create(void *canvas) {
 	x_draw_t *d = malloc(sizeof(x_draw_t));
 	assert(d != NULL);
@@ -48,13 +95,136 @@ void *draw_create(void *canvas) {
 	gtk_widget_set_double_buffered(d->widget, FALSE);
 	d->xdisp = NULL;
 	d->xwin = -1;
+	d->shm_available = -1;
+	d->back = None;
+	d->back_width = 0;
+	d->back_height = 0;
+	d->clipped = 0;
+	d->line_attribs.cap = CapRound;
+	d->points = NULL;
+	d->points_capacity = 0;
+	d->segments = NULL;
+	d->segments_capacity = 0;
+	d->arcs = NULL;
+	d->arcs_capacity = 0;
 
 	return (void *)d;
 }
 
+// X11 drawing needs a window, so there is no offscreen mode
+void *draw_create_image(int width, int height) {
+	return NULL;
+}
+
+int draw_image_write_png(void *dp, const char *filename) {
+	return -1;
+}
+
+unsigned char *draw_image_get_data(void *dp, int *stride_out) {
+	return NULL;
+}
+
+// assumes the usual 24 bit TrueColor visual, whose pixels are 0x00RRGGBB
+void draw_pixels(void *dp, unsigned char *data, int stride, int width, int height, float x, float y) {
+	x_draw_t *d = (x_draw_t *)dp;
+	int screen = DefaultScreen(d->xdisp);
+	XImage *img = XCreateImage(d->xdisp, DefaultVisual(d->xdisp, screen), 24, ZPixmap, 0, 
+		(char *)data, width, height, 32, stride);
+	XPutImage(d->xdisp, d->target, d->gc, img, 0, 0, x, y, width, height);
+	img->data = NULL; // not ours to free
+	XDestroyImage(img);
+}
+
+static int shm_attach_failed;
+
+static int shm_error_handler(Display *dpy, XErrorEvent *event) {
+	shm_attach_failed = 1;
+	return 0;
+}
+
+static int shm_check(Display *xdisp) {
+	int major, minor;
+	Bool pixmaps;
+	if(!XShmQueryExtension(xdisp) || !XShmQueryVersion(xdisp, &major, &minor, &pixmaps)) {
+		return 0;
+	}
+	return pixmaps && XShmPixmapFormat(xdisp) == ZPixmap;
+}
+
+static void back_buffer_free(x_draw_t *d) {
+	if(d->back == None) {
+		return;
+	}
+	XFreePixmap(d->xdisp, d->back);
+	XShmDetach(d->xdisp, &d->shm);
+	XSync(d->xdisp, False);
+	shmdt(d->shm.shmaddr);
+	d->back = None;
+}
+
+/* Make sure the back buffer matches the window size. */
+static void back_buffer_reserve(x_draw_t *d, int width, int height, int depth) {
+	if(d->back != None && d->back_width == width && d->back_height == height) {
+		return;
+	}
+	back_buffer_free(d);
+	if(!d->shm_available) {
+		return;
+	}
+
+	// let Xlib work out the row size for this depth
+	int screen = DefaultScreen(d->xdisp);
+	XImage *img = XShmCreateImage(d->xdisp, DefaultVisual(d->xdisp, screen), depth, ZPixmap, 
+		NULL, &d->shm, width, height);
+	if(img == NULL) {
+		d->shm_available = 0;
+		return;
+	}
+	size_t size = (size_t)img->bytes_per_line * height;
+	XDestroyImage(img);
+
+	d->shm.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+	if(d->shm.shmid < 0) {
+		d->shm_available = 0;
+		return;
+	}
+	d->shm.shmaddr = shmat(d->shm.shmid, NULL, 0);
+	d->shm.readOnly = False;
+	if(d->shm.shmaddr == (char *)-1) {
+		shmctl(d->shm.shmid, IPC_RMID, NULL);
+		d->shm_available = 0;
+		return;
+	}
+
+	// attaching fails asynchronously when the server can't see our memory
+	shm_attach_failed = 0;
+	XErrorHandler old_handler = XSetErrorHandler(shm_error_handler);
+	XShmAttach(d->xdisp, &d->shm);
+	XSync(d->xdisp, False);
+	XSetErrorHandler(old_handler);
+	// the segment goes away once both sides have detached
+	shmctl(d->shm.shmid, IPC_RMID, NULL);
+	if(shm_attach_failed) {
+		shmdt(d->shm.shmaddr);
+		d->shm_available = 0;
+		return;
+	}
+
+	d->back = XShmCreatePixmap(d->xdisp, d->xwin, d->shm.shmaddr, &d->shm, width, height, depth);
+	d->back_width = width;
+	d->back_height = height;
+}
+
 void draw_destroy(void *dp) {
-	if(dp) {
-		free(dp);
+	x_draw_t *d = (x_draw_t *)dp;
+	if(d) {
+		if(d->xdisp) {
+			back_buffer_free(d);
+		}
+		free(d->points);
+		free(d->segments);
+		free(d->arcs);
+		free(d);
 	}
 }
 
@@ -63,6 +233,7 @@ void draw_start(void *dp) {
 	if(d->xdisp == NULL) {
 		d->xdisp = gdk_x11_drawable_get_xdisplay(d->widget->window);
 		d->xwin =gdk_x11_drawable_get_xid(d->widget->window);	
+		d->target = d->xwin;
 
 		d->gc = XCreateGC(d->xdisp, d->xwin, 0, NULL);
 
@@ -77,12 +248,43 @@ void draw_start(void *dp) {
 
 		// setup some other X stuff
 		XSetFillStyle(d->xdisp, d->gc, FillSolid);
+		// copying the back buffer to the window shouldn't generate NoExpose events
+		XSetGraphicsExposures(d->xdisp, d->gc, False);
+
+		d->shm_available = shm_check(d->xdisp);
 	}
 
+	Window root_win;
+	unsigned int w, h;
+	int x, y;
+	unsigned int bord_w, depth;
+	XGetGeometry(d->xdisp, d->xwin, &root_win, &x, &y, &w, &h, &bord_w, &depth);
+	back_buffer_reserve(d, w, h, depth);
+	d->canvas = (d->back != None) ? d->back : d->xwin;
+	d->target = d->canvas;
 }
 
 void draw_finish(void *dp) {
-	;
+	x_draw_t *d = (x_draw_t *)dp;
+	if(d->back != None) {
+		XCopyArea(d->xdisp, d->back, d->xwin, d->gc, 0, 0, d->back_width, d->back_height, 0, 0);
+	}
+	if(d->clipped) {
+		XSetClipMask(d->xdisp, d->gc, None);
+		d->clipped = 0;
+	}
+	XFlush(d->xdisp);
+}
+
+// the clip stays on the gc, so it also limits the copy in draw_finish()
+void draw_clip(void *dp, float x, float y, float width, float height) {
+	x_draw_t *d = (x_draw_t *)dp;
+	d->clip.x = x;
+	d->clip.y = y;
+	d->clip.width = width;
+	d->clip.height = height;
+	d->clipped = 1;
+	XSetClipRectangles(d->xdisp, d->gc, 0, 0, &d->clip, 1, Unsorted);
 }
 
 void draw_get_canvas_dims(void *dp, float *width_out, float *height_out) {
@@ -118,7 +320,7 @@ float draw_get_canvas_height(void *dp) {
 
 void draw_line(void *dp, float x1, float y1, float x2, float y2) {
 	x_draw_t *d = (x_draw_t *)dp;
-	XDrawLine(d->xdisp, d->xwin, d->gc, x1, y1, x2, y2);
+	XDrawLine(d->xdisp, d->target, d->gc, x1, y1, x2, y2);
 }
 
 
@@ -144,7 +346,7 @@ void draw_rectangle_filled(void *dp, float x1, float y1, float x2, float y2) {
 		height = y1 - y2;
 	}
 	
-	XFillRectangle(d->xdisp, d->xwin, d->gc, x_left, y_upper, width, height);
+	XFillRectangle(d->xdisp, d->target, d->gc, x_left, y_upper, width, height);
 }
 
 void draw_rectangle_outline(void *dp, float x1, float y1, float x2, float y2) {
@@ -169,42 +371,201 @@ void draw_rectangle_outline(void *dp, float x1, float y1, float x2, float y2) {
 		height = y1 - y2;
 	}
 	
-	XDrawRectangle(d->xdisp, d->xwin, d->gc, x_left, y_upper, width, height);
+	XDrawRectangle(d->xdisp, d->target, d->gc, x_left, y_upper, width, height);
 }
 
 void draw_circle_outline(void *dp, float x_c, float y_c, float radius) {
 	x_draw_t *d = (x_draw_t *)dp;
-	XDrawArc(d->xdisp, d->xwin, d->gc, x_c - radius, y_c - radius, 2*radius, 2*radius, 0, 23040);
+	XDrawArc(d->xdisp, d->target, d->gc, x_c - radius, y_c - radius, 2*radius, 2*radius, 0, 23040);
 }
 
 void draw_circle_filled(void *dp, float x_c, float y_c, float radius) {
 	x_draw_t *d = (x_draw_t *)dp;
-	XFillArc(d->xdisp, d->xwin, d->gc, x_c - radius, y_c - radius, 2*radius, 2*radius, 0, 23040);
+	XFillArc(d->xdisp, d->target, d->gc, x_c - radius, y_c - radius, 2*radius, 2*radius, 0, 23040);
 }
 
-#define MAX_POLYGON_POINTS 2000
 void draw_polygon_outline(void *dp, float *x, float *y, int num_points) {
 	x_draw_t *d = (x_draw_t *)dp;
-	static XPoint points[MAX_POLYGON_POINTS];
-	assert(num_points <= MAX_POLYGON_POINTS);
+	XPoint *points = RESERVE_POINTS(d, num_points);
 	int i;
 	for(i=0; i < num_points; i++) {
 		points[i].x = x[i];
 		points[i].y = y[i];
 	}
-	XDrawLines(d->xdisp, d->xwin, d->gc, points, num_points, CoordModeOrigin);
+	XDrawLines(d->xdisp, d->target, d->gc, points, num_points, CoordModeOrigin);
 }
 
 void draw_polygon_filled(void *dp, float *x, float *y, int num_points) {
 	x_draw_t *d = (x_draw_t *)dp;
-	static XPoint points[MAX_POLYGON_POINTS];
-	assert(num_points <= MAX_POLYGON_POINTS);
+	XPoint *points = RESERVE_POINTS(d, num_points);
 	int i;
 	for(i=0; i < num_points; i++) {
 		points[i].x = x[i];
 		points[i].y = y[i];
 	}
-	XFillPolygon(d->xdisp, d->xwin, d->gc, points, num_points, Nonconvex, CoordModeOrigin);
+	XFillPolygon(d->xdisp, d->target, d->gc, points, num_points, Nonconvex, CoordModeOrigin);
+}
+
+void draw_lines(void *dp, float *x1, float *y1, float *x2, float *y2, int count) {
+	x_draw_t *d = (x_draw_t *)dp;
+	XSegment *segs = RESERVE_SEGMENTS(d, count);
+	int i;
+	for(i=0; i < count; i++) {
+		segs[i].x1 = x1[i];
+		segs[i].y1 = y1[i];
+		segs[i].x2 = x2[i];
+		segs[i].y2 = y2[i];
+	}
+	XDrawSegments(d->xdisp, d->target, d->gc, segs, count);
+}
+
+static XArc *make_arcs(x_draw_t *d, float *x_c, float *y_c, float *radius, int count) {
+	XArc *arcs = RESERVE_ARCS(d, count);
+	int i;
+	for(i=0; i < count; i++) {
+		arcs[i].x = x_c[i] - radius[i];
+		arcs[i].y = y_c[i] - radius[i];
+		arcs[i].width = 2*radius[i];
+		arcs[i].height = 2*radius[i];
+		arcs[i].angle1 = 0;
+		arcs[i].angle2 = 23040;
+	}
+	return arcs;
+}
+
+void draw_circles_outline(void *dp, float *x_c, float *y_c, float *radius, int count) {
+	x_draw_t *d = (x_draw_t *)dp;
+	XDrawArcs(d->xdisp, d->target, d->gc, make_arcs(d, x_c, y_c, radius, count), count);
+}
+
+void draw_circles_filled(void *dp, float *x_c, float *y_c, float *radius, int count) {
+	x_draw_t *d = (x_draw_t *)dp;
+	XFillArcs(d->xdisp, d->target, d->gc, make_arcs(d, x_c, y_c, radius, count), count);
+}
+
+void draw_points(void *dp, float *x, float *y, int count) {
+	x_draw_t *d = (x_draw_t *)dp;
+	XPoint *points = RESERVE_POINTS(d, count);
+	int i;
+	for(i=0; i < count; i++) {
+		points[i].x = x[i];
+		points[i].y = y[i];
+	}
+	XDrawPoints(d->xdisp, d->target, d->gc, points, count, CoordModeOrigin);
+}
+
+/* Thin polygon outlines are sent as one XDrawSegments request for the
+ * whole batch.  Wide ones keep XDrawLines so the corners are still mitered.
+ * There is no batched fill request in core X, so filled polygons still go
+ * out one XFillPolygon each (Xlib buffers them into one flush). */
+void draw_polygons_outline(void *dp, float *x, float *y, int *counts, int num_polygons) {
+	x_draw_t *d = (x_draw_t *)dp;
+	int i, j;
+	if(d->line_attribs.width > 1) {
+		for(i=0; i < num_polygons; i++) {
+			draw_polygon_outline(dp, x, y, counts[i]);
+			x += counts[i];
+			y += counts[i];
+		}
+		return;
+	}
+	int num_segs = 0;
+	for(i=0; i < num_polygons; i++) {
+		num_segs += counts[i] - 1;
+	}
+	XSegment *segs = RESERVE_SEGMENTS(d, num_segs);
+	XSegment *seg = segs;
+	for(i=0; i < num_polygons; i++) {
+		for(j=1; j < counts[i]; j++) {
+			seg->x1 = x[j-1];
+			seg->y1 = y[j-1];
+			seg->x2 = x[j];
+			seg->y2 = y[j];
+			seg++;
+		}
+		x += counts[i];
+		y += counts[i];
+	}
+	XDrawSegments(d->xdisp, d->target, d->gc, segs, num_segs);
+}
+
+void draw_polygons_filled(void *dp, float *x, float *y, int *counts, int num_polygons) {
+	int i;
+	for(i=0; i < num_polygons; i++) {
+		draw_polygon_filled(dp, x, y, counts[i]);
+		x += counts[i];
+		y += counts[i];
+	}
+}
+
+typedef struct {
+	Pixmap pixmap;
+	int width;
+	int height;
+} x_layer_t;
+
+void *draw_layer_create(void *dp, int width, int height) {
+	x_draw_t *d = (x_draw_t *)dp;
+	Window root_win;
+	unsigned int w, h;
+	int x, y;
+	unsigned int bord_w, depth;
+	XGetGeometry(d->xdisp, d->xwin, &root_win, &x, &y, &w, &h, &bord_w, &depth);
+
+	x_layer_t *l = malloc(sizeof(x_layer_t));
+	assert(l != NULL);
+	l->pixmap = XCreatePixmap(d->xdisp, d->xwin, width, height, depth);
+	l->width = width;
+	l->height = height;
+	return (void *)l;
+}
+
+void draw_layer_destroy(void *dp, void *lp) {
+	x_draw_t *d = (x_draw_t *)dp;
+	x_layer_t *l = (x_layer_t *)lp;
+	if(l) {
+		XFreePixmap(d->xdisp, l->pixmap);
+		free(l);
+	}
+}
+
+void draw_layer_begin(void *dp, void *lp) {
+	x_draw_t *d = (x_draw_t *)dp;
+	d->target = ((x_layer_t *)lp)->pixmap;
+	if(d->clipped) {
+		XSetClipMask(d->xdisp, d->gc, None);
+	}
+}
+
+void draw_layer_end(void *dp) {
+	x_draw_t *d = (x_draw_t *)dp;
+	d->target = d->canvas;
+	if(d->clipped) {
+		XSetClipRectangles(d->xdisp, d->gc, 0, 0, &d->clip, 1, Unsorted);
+	}
+}
+
+void draw_layer_blit(void *dp, void *lp, float x, float y) {
+	x_draw_t *d = (x_draw_t *)dp;
+	x_layer_t *l = (x_layer_t *)lp;
+	XCopyArea(d->xdisp, l->pixmap, d->target, d->gc, 0, 0, l->width, l->height, x, y);
+}
+
+// core X has neither alpha masks nor rotation, so there are no sprites
+void *draw_sprite_create(void *dp, int width, int height) {
+	return NULL;
+}
+
+void draw_sprite_destroy(void *dp, void *sp) {
+}
+
+void draw_sprite_begin(void *dp, void *sp) {
+}
+
+void draw_sprite_end(void *dp) {
+}
+
+void draw_sprite_blit(void *dp, void *sp, float x, float y, float angle) {
 }
 
 void draw_get_text_dims(void *dp, char *text, float font_size, float *width_out, float *height_out) {
@@ -294,7 +655,7 @@ void draw_text(void *dp, char *text, float font_size, float x, float y, int anch
       x_left = x;
       y_bottom = y;
   }
-	XDrawString(d->xdisp, d->xwin, d->gc, x_left, y_bottom, text, strlen(text));
+	XDrawString(d->xdisp, d->target, d->gc, x_left, y_bottom, text, strlen(text));
 }
 
 static uint8_t color_float_to_u8(float f) {
@@ -318,13 +679,27 @@ void draw_set_color(void *dp, float r, float g, float b) {
 	}
 }
 
+// JoinMiter has X's own fixed miter limit, which DRAW_MITER_LIMIT matches
 void draw_set_line_width(void *dp, float w) {
 	x_draw_t *d = (x_draw_t *)dp;
 	int width = w;
 	line_attribs_t *la = &(d->line_attribs);
 	if(width != la->width) {
 		la->width = width;
-		XSetLineAttributes(d->xdisp, d->gc, la->width, la->style, CapRound, JoinMiter);
+		XSetLineAttributes(d->xdisp, d->gc, la->width, la->style, la->cap, JoinMiter);
+	}
+}
+
+// X doesn't anti-alias, so only the line caps change
+void draw_set_quality(void *dp, int quality) {
+	x_draw_t *d = (x_draw_t *)dp;
+	line_attribs_t *la = &(d->line_attribs);
+	int cap = (quality == DRAW_QUALITY_FAST) ? CapButt : CapRound;
+	if(cap != la->cap) {
+		la->cap = cap;
+		if(d->xdisp != NULL && la->width >= 0) {
+			XSetLineAttributes(d->xdisp, d->gc, la->width, la->style, la->cap, JoinMiter);
+		}
 	}
 }
 
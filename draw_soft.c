@@ -0,0 +1,1208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <gtk/gtk.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "draw.h"
+
+/* Software rasterizer backend.  Everything is drawn into a framebuffer in
+ * memory (32 bit 0x00RRGGBB pixels, like a cairo RGB24 image).  Shapes are
+ * broken into horizontal spans: the inside of a span is filled with SSE2
+ * stores, and when anti-aliasing, the edge pixels are blended by coverage.
+ * On a widget, draw_finish() copies the frame to the window in one
+ * gdk_draw_rgb_image() call.  Image drawers don't use GTK at all. */
+
+// 1 to anti-alias edges by coverage, 0 to fill the pixels whose centers are inside
+#define ANTIALIAS 1
+
+// vertical samples per pixel row when anti-aliasing
+#define AA_SUBSAMPLES 4
+
+typedef struct {
+	uint32_t *pixels;
+	int width;
+	int height;
+	int clip_x0; // drawing is limited to [clip_x0,clip_x1) x [clip_y0,clip_y1)
+	int clip_y0;
+	int clip_x1;
+	int clip_y1;
+} surface_t;
+
+typedef struct {
+	float x0;
+	float y0;
+	float dxdy;
+	float y_min;
+	float y_max;
+	int dir; // +1 going down, -1 going up (for the nonzero winding rule)
+} edge_t;
+
+typedef struct {
+	float x;
+	int dir;
+} crossing_t;
+
+typedef struct {
+	GtkWidget *widget; // NULL for image drawers
+	surface_t canvas;
+	surface_t *target; // &canvas, or a layer between draw_layer_begin/end
+	uint32_t color;
+	float line_width;
+	int antialias;
+	int quality;
+	uint32_t sprite_saved_color; // the real color while drawing into a sprite
+	int in_sprite;
+
+	unsigned char *rgb; // staging for gdk_draw_rgb_image()
+	int rgb_capacity;
+
+	// rasterizer scratch
+	float *xs; // span end points on one scanline
+	int xs_capacity;
+	edge_t *edges;
+	int edges_capacity;
+	int *active;
+	int active_capacity;
+	crossing_t *crossings;
+	int crossings_capacity;
+	float *cov;   // coverage of one row: partial pixels...
+	float *delta; // ...and runs of full ones, as differences
+	int cov_capacity;
+} soft_draw_t;
+
+static void *scratch_reserve(void *buf, int *capacity, int needed, size_t elem_size) {
+	if(needed <= *capacity) {
+		return buf;
+	}
+	int new_capacity = (*capacity > 0) ? *capacity : 64;
+	while(new_capacity < needed) {
+		new_capacity *= 2;
+	}
+	buf = realloc(buf, new_capacity * elem_size);
+	assert(buf != NULL);
+	*capacity = new_capacity;
+	return buf;
+}
+
+#define RESERVE(d, field, n) \
+	((d)->field = scratch_reserve((d)->field, &(d)->field##_capacity, (n), sizeof((d)->field[0])))
+
+static void surface_unclip(surface_t *s) {
+	s->clip_x0 = 0;
+	s->clip_y0 = 0;
+	s->clip_x1 = s->width;
+	s->clip_y1 = s->height;
+}
+
+static void surface_resize(surface_t *s, int width, int height) {
+	if(s->pixels && s->width == width && s->height == height) {
+		return;
+	}
+	free(s->pixels);
+	s->pixels = malloc((size_t)width * height * sizeof(uint32_t));
+	assert(s->pixels != NULL);
+	s->width = width;
+	s->height = height;
+	surface_unclip(s);
+}
+
+/* Spans ***************************************************************/
+
+static void span_fill(uint32_t *row, int x0, int x1, uint32_t color) {
+	int x = x0;
+#ifdef __SSE2__
+	__m128i c = _mm_set1_epi32((int)color);
+	for(; x < x1 && ((uintptr_t)&row[x] & 15); x++) {
+		row[x] = color;
+	}
+	for(; x + 16 <= x1; x += 16) {
+		_mm_store_si128((__m128i *)&row[x], c);
+		_mm_store_si128((__m128i *)&row[x + 4], c);
+		_mm_store_si128((__m128i *)&row[x + 8], c);
+		_mm_store_si128((__m128i *)&row[x + 12], c);
+	}
+	for(; x + 4 <= x1; x += 4) {
+		_mm_store_si128((__m128i *)&row[x], c);
+	}
+#endif
+	for(; x < x1; x++) {
+		row[x] = color;
+	}
+}
+
+// a is 0..256
+static inline uint32_t blend(uint32_t dst, uint32_t src, int a) {
+	uint32_t rb = ((src & 0xFF00FF) * a + (dst & 0xFF00FF) * (256 - a)) >> 8;
+	uint32_t g = ((src & 0x00FF00) * a + (dst & 0x00FF00) * (256 - a)) >> 8;
+	return (rb & 0xFF00FF) | (g & 0x00FF00);
+}
+
+// the coverage arrays are kept zeroed between rows
+static void coverage_reserve(soft_draw_t *d, int n) {
+	if(n <= d->cov_capacity) {
+		return;
+	}
+	free(d->cov);
+	free(d->delta);
+	d->cov = calloc(n, sizeof(float));
+	d->delta = calloc(n, sizeof(float));
+	assert(d->cov != NULL && d->delta != NULL);
+	d->cov_capacity = n;
+}
+
+static void coverage_add(soft_draw_t *d, float xa, float xb, float w, int *lo, int *hi) {
+	if(xa < d->target->clip_x0) xa = d->target->clip_x0;
+	if(xb > d->target->clip_x1) xb = d->target->clip_x1;
+	if(!(xb > xa)) {
+		return;
+	}
+	int i0 = (int)xa;
+	int i1 = (int)xb;
+	if(i0 == i1) {
+		d->cov[i0] += (xb - xa) * w;
+	} else {
+		d->cov[i0] += (i0 + 1 - xa) * w;
+		d->delta[i0 + 1] += w;
+		d->delta[i1] -= w;
+		d->cov[i1] += (xb - i1) * w;
+	}
+	if(i0 < *lo) *lo = i0;
+	if(i1 > *hi) *hi = i1;
+}
+
+/* Turn a row of accumulated coverage into pixels (and clear it for the
+ * next row): fully covered runs are span filled, edges are blended. */
+static void coverage_resolve(soft_draw_t *d, uint32_t *row, int lo, int hi) {
+	int width = d->target->clip_x1;
+	float run = 0;
+	int full_start = -1;
+	int x;
+	for(x=lo; x <= hi; x++) {
+		run += d->delta[x];
+		float c = run + d->cov[x];
+		d->delta[x] = 0;
+		d->cov[x] = 0;
+		if(x == width) {
+			break;
+		}
+		if(c >= 1.0f - 1.0f/512) {
+			if(full_start < 0) {
+				full_start = x;
+			}
+			continue;
+		}
+		if(full_start >= 0) {
+			span_fill(row, full_start, x, d->color);
+			full_start = -1;
+		}
+		if(c > 1.0f/512) {
+			row[x] = blend(row[x], d->color, (int)(c * 256 + 0.5f));
+		}
+	}
+	if(full_start >= 0) {
+		span_fill(row, full_start, x < width ? x : width, d->color);
+	}
+}
+
+/* A shape is anything that can list the spans it covers on a scanline.
+ * spans() is called with increasing y and writes pairs of (start, end) x
+ * coordinates to xs, returning the number of floats written. */
+typedef int (*spans_func)(soft_draw_t *d, void *shape, float y, float *xs);
+
+static void fill_shape(soft_draw_t *d, void *shape, spans_func spans, float y_min, float y_max) {
+	surface_t *s = d->target;
+	int row0 = (int)floorf(y_min);
+	int row1 = (int)ceilf(y_max);
+	if(row0 < s->clip_y0) row0 = s->clip_y0;
+	if(row1 > s->clip_y1) row1 = s->clip_y1;
+	coverage_reserve(d, s->width + 2);
+
+	int iy, k;
+	for(iy=row0; iy < row1; iy++) {
+		uint32_t *row = s->pixels + (size_t)iy * s->width;
+		if(!d->antialias) {
+			int n = spans(d, shape, iy + 0.5f, d->xs);
+			for(k=0; k < n; k += 2) {
+				int x0 = (int)ceilf(d->xs[k] - 0.5f);
+				int x1 = (int)ceilf(d->xs[k + 1] - 0.5f);
+				if(x0 < s->clip_x0) x0 = s->clip_x0;
+				if(x1 > s->clip_x1) x1 = s->clip_x1;
+				if(x1 > x0) {
+					span_fill(row, x0, x1, d->color);
+				}
+			}
+			continue;
+		}
+		int lo = s->width + 1;
+		int hi = -1;
+		int sub;
+		for(sub=0; sub < AA_SUBSAMPLES; sub++) {
+			int n = spans(d, shape, iy + (sub + 0.5f) / AA_SUBSAMPLES, d->xs);
+			for(k=0; k < n; k += 2) {
+				coverage_add(d, d->xs[k], d->xs[k + 1], 1.0f / AA_SUBSAMPLES, &lo, &hi);
+			}
+		}
+		if(hi >= lo) {
+			coverage_resolve(d, row, lo, hi);
+		}
+	}
+}
+
+/* Polygons (nonzero winding rule, like cairo's default) *****************/
+
+typedef struct {
+	int num_edges;
+	int next; // next edge (sorted by y_min) to become active
+	int num_active;
+} poly_shape_t;
+
+static int edge_compare(const void *a, const void *b) {
+	const edge_t *ea = a;
+	const edge_t *eb = b;
+	return (ea->y_min > eb->y_min) - (ea->y_min < eb->y_min);
+}
+
+static int crossing_compare(const void *a, const void *b) {
+	const crossing_t *ca = a;
+	const crossing_t *cb = b;
+	return (ca->x > cb->x) - (ca->x < cb->x);
+}
+
+static int poly_spans(soft_draw_t *d, void *shape, float y, float *xs) {
+	poly_shape_t *p = shape;
+	int k, m = 0;
+
+	// drop the edges that ended above this scanline, then add the new ones
+	for(k=0; k < p->num_active; k++) {
+		if(y < d->edges[d->active[k]].y_max) {
+			d->active[m++] = d->active[k];
+		}
+	}
+	for(; p->next < p->num_edges && d->edges[p->next].y_min <= y; p->next++) {
+		if(y < d->edges[p->next].y_max) {
+			d->active[m++] = p->next;
+		}
+	}
+	p->num_active = m;
+
+	crossing_t *c = d->crossings;
+	for(k=0; k < m; k++) {
+		edge_t *e = &d->edges[d->active[k]];
+		c[k].x = e->x0 + (y - e->y0) * e->dxdy;
+		c[k].dir = e->dir;
+	}
+	if(m > 16) {
+		qsort(c, m, sizeof(c[0]), crossing_compare);
+	} else {
+		for(k=1; k < m; k++) {
+			crossing_t t = c[k];
+			int j = k;
+			for(; j > 0 && c[j - 1].x > t.x; j--) {
+				c[j] = c[j - 1];
+			}
+			c[j] = t;
+		}
+	}
+
+	int n = 0;
+	int winding = 0;
+	for(k=0; k < m; k++) {
+		int prev = winding;
+		winding += c[k].dir;
+		if(prev == 0 && winding != 0) {
+			xs[n++] = c[k].x;
+		} else if(prev != 0 && winding == 0) {
+			xs[n++] = c[k].x;
+		}
+	}
+	return n;
+}
+
+/* Append a closed polygon to the first n edges in d->edges.  Returns the
+ * new number of edges.  With upright set, the polygon is turned so it
+ * winds the same way as every other upright one: then overlapping pieces
+ * add up under the nonzero rule instead of cancelling. */
+static int poly_add_edges(soft_draw_t *d, int n, const float *x, const float *y, int num_points, int upright) {
+	int i;
+	int flip = 1;
+	if(upright) {
+		float area2 = 0;
+		for(i=0; i < num_points; i++) {
+			int j = (i + 1 < num_points) ? i + 1 : 0;
+			area2 += x[i] * y[j] - x[j] * y[i];
+		}
+		flip = (area2 < 0) ? -1 : 1;
+	}
+	RESERVE(d, edges, n + num_points);
+	for(i=0; i < num_points; i++) {
+		int j = (i + 1 < num_points) ? i + 1 : 0;
+		if(y[i] == y[j]) {
+			continue;
+		}
+		edge_t *e = &d->edges[n++];
+		e->dir = ((y[j] > y[i]) ? 1 : -1) * flip;
+		e->x0 = x[i];
+		e->y0 = y[i];
+		e->dxdy = (x[j] - x[i]) / (y[j] - y[i]);
+		e->y_min = fminf(y[i], y[j]);
+		e->y_max = fmaxf(y[i], y[j]);
+	}
+	return n;
+}
+
+// fill the first n edges in d->edges, in one pass
+static void fill_edges(soft_draw_t *d, int n) {
+	int i;
+	if(n == 0) {
+		return;
+	}
+	float y_min = INFINITY;
+	float y_max = -INFINITY;
+	for(i=0; i < n; i++) {
+		y_min = fminf(y_min, d->edges[i].y_min);
+		y_max = fmaxf(y_max, d->edges[i].y_max);
+	}
+	qsort(d->edges, n, sizeof(edge_t), edge_compare);
+	RESERVE(d, active, n);
+	RESERVE(d, crossings, n);
+	RESERVE(d, xs, n);
+
+	poly_shape_t p = {n, 0, 0};
+	fill_shape(d, &p, poly_spans, y_min, y_max);
+}
+
+static void fill_polygon(soft_draw_t *d, float *x, float *y, int num_points) {
+	fill_edges(d, poly_add_edges(d, 0, x, y, num_points, 0));
+}
+
+/* Circles and rings ****************************************************/
+
+typedef struct {
+	float x_c;
+	float y_c;
+	float r_outer;
+	float r_inner; // 0 for a filled circle
+} ring_shape_t;
+
+static int ring_spans(soft_draw_t *d, void *shape, float y, float *xs) {
+	ring_shape_t *r = shape;
+	float dy = y - r->y_c;
+	if(fabsf(dy) >= r->r_outer) {
+		return 0;
+	}
+	float h_out = sqrtf(r->r_outer * r->r_outer - dy * dy);
+	if(fabsf(dy) >= r->r_inner) {
+		xs[0] = r->x_c - h_out;
+		xs[1] = r->x_c + h_out;
+		return 2;
+	}
+	float h_in = sqrtf(r->r_inner * r->r_inner - dy * dy);
+	xs[0] = r->x_c - h_out;
+	xs[1] = r->x_c - h_in;
+	xs[2] = r->x_c + h_in;
+	xs[3] = r->x_c + h_out;
+	return 4;
+}
+
+static void fill_ring(soft_draw_t *d, float x_c, float y_c, float r_outer, float r_inner) {
+	if(!(r_outer > 0)) {
+		return;
+	}
+	RESERVE(d, xs, 4);
+	ring_shape_t r = {x_c, y_c, r_outer, r_inner > 0 ? r_inner : 0};
+	fill_shape(d, &r, ring_spans, y_c - r_outer, y_c + r_outer);
+}
+
+/* Strokes **************************************************************/
+
+// lines thinner than a pixel are drawn one pixel wide
+static float stroke_width(soft_draw_t *d) {
+	return (d->line_width < 1) ? 1 : d->line_width;
+}
+
+// add one segment with butt ends to the first n edges; returns the new count
+static int stroke_add_segment(soft_draw_t *d, int n, float x1, float y1, float x2, float y2) {
+	float dx = x2 - x1;
+	float dy = y2 - y1;
+	float len = sqrtf(dx * dx + dy * dy);
+	if(len == 0) {
+		return n;
+	}
+	float h = stroke_width(d) / 2;
+	float nx = -dy / len * h;
+	float ny = dx / len * h;
+	float x[4] = {x1 + nx, x2 + nx, x2 - nx, x1 - nx};
+	float y[4] = {y1 + ny, y2 + ny, y2 - ny, y1 - ny};
+	return poly_add_edges(d, n, x, y, 4, 1);
+}
+
+/* Add the join at (x,y) between a segment going in unit direction (ux1,uy1)
+ * and the next one going in (ux2,uy2): a miter, or a bevel past
+ * DRAW_MITER_LIMIT, like cairo and X11.  Only the outside of the corner
+ * needs filling; the segments already cover the inside. */
+static int stroke_add_join(soft_draw_t *d, int n, float x, float y, float ux1, float uy1, float ux2, float uy2) {
+	float cross = ux1 * uy2 - uy1 * ux2;
+	if(fabsf(cross) < 1e-6f) {
+		return n; // straight on, or doubling back (nothing to bevel)
+	}
+	float h = stroke_width(d) / 2;
+	float side = (cross > 0) ? -h : h; // the outside of the turn
+	float ax = x - uy1 * side;
+	float ay = y + ux1 * side;
+	float bx = x - uy2 * side;
+	float by = y + ux2 * side;
+	// the miter tip is along the sum of the normals, 1/sin(angle/2) half widths out
+	float mx = -uy1 - uy2;
+	float my = ux1 + ux2;
+	float m2 = mx * mx + my * my;
+	if(4 <= DRAW_MITER_LIMIT * DRAW_MITER_LIMIT * m2) {
+		float jx[4] = {x, ax, x + mx * 2 * side / m2, bx};
+		float jy[4] = {y, ay, y + my * 2 * side / m2, by};
+		return poly_add_edges(d, n, jx, jy, 4, 1);
+	}
+	float jx[3] = {x, ax, bx};
+	float jy[3] = {y, ay, by};
+	return poly_add_edges(d, n, jx, jy, 3, 1);
+}
+
+// one segment with butt ends
+static void stroke_segment(soft_draw_t *d, float x1, float y1, float x2, float y2) {
+	fill_edges(d, stroke_add_segment(d, 0, x1, y1, x2, y2));
+}
+
+/* An open polyline, like the other backends' polygon outlines.  The
+ * segments and joins go into one edge list and are filled together, so
+ * where they overlap the edge pixels are still only blended once. */
+static void stroke_polyline(soft_draw_t *d, float *x, float *y, int num_points) {
+	int i, n = 0;
+	float ux = 0, uy = 0; // direction of the last segment drawn, 0 before the first
+	for(i=1; i < num_points; i++) {
+		float dx = x[i] - x[i - 1];
+		float dy = y[i] - y[i - 1];
+		float len = sqrtf(dx * dx + dy * dy);
+		if(len == 0) {
+			continue;
+		}
+		dx /= len;
+		dy /= len;
+		if(ux != 0 || uy != 0) {
+			n = stroke_add_join(d, n, x[i - 1], y[i - 1], ux, uy, dx, dy);
+		}
+		n = stroke_add_segment(d, n, x[i - 1], y[i - 1], x[i], y[i]);
+		ux = dx;
+		uy = dy;
+	}
+	fill_edges(d, n);
+}
+
+/* Text *****************************************************************/
+
+/* 5x7 bitmap font for ASCII 32..126.  One byte per row, top row first;
+ * bit 4 is the leftmost column. */
+static const unsigned char font_5x7[95][7] = {
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // space
+	{0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, // !
+	{0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00}, // "
+	{0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A}, // #
+	{0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04}, // $
+	{0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, // %
+	{0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D}, // &
+	{0x04, 0x04, 0x04, 0x00, 0x00, 0x00, 0x00}, // quote
+	{0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, // (
+	{0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, // )
+	{0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00}, // *
+	{0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00}, // +
+	{0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08}, // ,
+	{0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}, // -
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C}, // .
+	{0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, // /
+	{0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, // 0
+	{0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E}, // 1
+	{0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, // 2
+	{0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}, // 3
+	{0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, // 4
+	{0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}, // 5
+	{0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, // 6
+	{0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+	{0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, // 8
+	{0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}, // 9
+	{0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00}, // :
+	{0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08}, // ;
+	{0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, // <
+	{0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00}, // =
+	{0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, // >
+	{0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04}, // ?
+	{0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E}, // @
+	{0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // A
+	{0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}, // B
+	{0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}, // C
+	{0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C}, // D
+	{0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, // E
+	{0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10}, // F
+	{0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}, // G
+	{0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // H
+	{0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, // I
+	{0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C}, // J
+	{0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, // K
+	{0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F}, // L
+	{0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, // M
+	{0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, // N
+	{0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // O
+	{0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10}, // P
+	{0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}, // Q
+	{0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11}, // R
+	{0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, // S
+	{0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // T
+	{0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // U
+	{0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04}, // V
+	{0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}, // W
+	{0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11}, // X
+	{0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04}, // Y
+	{0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F}, // Z
+	{0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E}, // [
+	{0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00}, // backslash
+	{0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E}, // ]
+	{0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00}, // ^
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F}, // _
+	{0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00}, // `
+	{0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F}, // a
+	{0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E}, // b
+	{0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E}, // c
+	{0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F}, // d
+	{0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E}, // e
+	{0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08}, // f
+	{0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E}, // g
+	{0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11}, // h
+	{0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E}, // i
+	{0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C}, // j
+	{0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12}, // k
+	{0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, // l
+	{0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11}, // m
+	{0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11}, // n
+	{0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E}, // o
+	{0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10}, // p
+	{0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01}, // q
+	{0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10}, // r
+	{0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E}, // s
+	{0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06}, // t
+	{0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D}, // u
+	{0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04}, // v
+	{0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A}, // w
+	{0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11}, // x
+	{0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E}, // y
+	{0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F}, // z
+	{0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02}, // {
+	{0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // |
+	{0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08}, // }
+	{0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00}, // ~
+};
+
+// glyphs are scaled by whole pixels; font_size 7 draws them 1:1
+static int font_scale(float font_size) {
+	int s = (int)(font_size / 7 + 0.5f);
+	return (s < 1) ? 1 : s;
+}
+
+/* draw.h interface ******************************************************/
+
+static soft_draw_t *soft_draw_alloc(void) {
+	soft_draw_t *d = calloc(1, sizeof(soft_draw_t));
+	assert(d != NULL);
+	d->target = &d->canvas;
+	d->line_width = 1;
+	d->antialias = ANTIALIAS;
+	d->quality = DRAW_QUALITY_BEST;
+	return d;
+}
+
+void *draw_create(void *canvas) {
+	soft_draw_t *d = soft_draw_alloc();
+	d->widget = (GtkWidget *)canvas;
+	// frames are copied to the window straight from the canvas, so GTK needn't buffer them
+	gtk_widget_set_double_buffered(d->widget, FALSE);
+	return (void *)d;
+}
+
+void *draw_create_image(int width, int height) {
+	soft_draw_t *d = soft_draw_alloc();
+	surface_resize(&d->canvas, width, height);
+	return (void *)d;
+}
+
+void draw_destroy(void *dp) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	if(d) {
+		free(d->canvas.pixels);
+		free(d->rgb);
+		free(d->xs);
+		free(d->edges);
+		free(d->active);
+		free(d->crossings);
+		free(d->cov);
+		free(d->delta);
+		free(d);
+	}
+}
+
+void draw_start(void *dp) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	if(d->widget) {
+		surface_resize(&d->canvas, d->widget->allocation.width, d->widget->allocation.height);
+	}
+	d->target = &d->canvas;
+	surface_unclip(d->target);
+}
+
+void draw_clip(void *dp, float x, float y, float width, float height) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	surface_t *s = &d->canvas;
+	int x0 = (int)floorf(x);
+	int y0 = (int)floorf(y);
+	int x1 = (int)ceilf(x + width);
+	int y1 = (int)ceilf(y + height);
+	s->clip_x0 = (x0 > 0) ? x0 : 0;
+	s->clip_y0 = (y0 > 0) ? y0 : 0;
+	s->clip_x1 = (x1 < s->width) ? x1 : s->width;
+	s->clip_y1 = (y1 < s->height) ? y1 : s->height;
+	if(s->clip_x1 < s->clip_x0) s->clip_x1 = s->clip_x0;
+	if(s->clip_y1 < s->clip_y0) s->clip_y1 = s->clip_y0;
+}
+
+// lines have no caps here; fast drawing skips anti-aliasing and polyline joins
+void draw_set_quality(void *dp, int quality) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	d->quality = quality;
+	d->antialias = (quality == DRAW_QUALITY_FAST) ? 0 : ANTIALIAS;
+}
+
+void draw_finish(void *dp) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	if(d->widget == NULL) {
+		return;
+	}
+	// only the clip rectangle can have changed
+	surface_t *s = &d->canvas;
+	int w = s->clip_x1 - s->clip_x0;
+	int h = s->clip_y1 - s->clip_y0;
+	if(w <= 0 || h <= 0) {
+		return;
+	}
+	RESERVE(d, rgb, 3 * w * h);
+	unsigned char *out = d->rgb;
+	int row, col;
+	for(row=s->clip_y0; row < s->clip_y1; row++) {
+		const uint32_t *px = s->pixels + (size_t)row * s->width + s->clip_x0;
+		for(col=0; col < w; col++) {
+			*out++ = px[col] >> 16;
+			*out++ = px[col] >> 8;
+			*out++ = px[col];
+		}
+	}
+	gdk_draw_rgb_image(d->widget->window, d->widget->style->fg_gc[GTK_STATE_NORMAL],
+		s->clip_x0, s->clip_y0, w, h, GDK_RGB_DITHER_NONE, d->rgb, 3 * w);
+}
+
+unsigned char *draw_image_get_data(void *dp, int *stride_out) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	*stride_out = d->canvas.width * sizeof(uint32_t);
+	return (unsigned char *)d->canvas.pixels;
+}
+
+void draw_get_canvas_dims(void *dp, float *width_out, float *height_out) {
+	*width_out = draw_get_canvas_width(dp);
+	*height_out = draw_get_canvas_height(dp);
+}
+
+float draw_get_canvas_width(void *dp) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	return d->widget ? d->widget->allocation.width : d->canvas.width;
+}
+
+float draw_get_canvas_height(void *dp) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	return d->widget ? d->widget->allocation.height : d->canvas.height;
+}
+
+void draw_set_color(void *dp, float r, float g, float b) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	uint32_t r8 = (r <= 0) ? 0 : (r >= 1) ? 255 : (uint32_t)(r * 255 + 0.5f);
+	uint32_t g8 = (g <= 0) ? 0 : (g >= 1) ? 255 : (uint32_t)(g * 255 + 0.5f);
+	uint32_t b8 = (b <= 0) ? 0 : (b >= 1) ? 255 : (uint32_t)(b * 255 + 0.5f);
+	if(d->in_sprite) {
+		d->sprite_saved_color = (r8 << 16) | (g8 << 8) | b8;
+		return;
+	}
+	d->color = (r8 << 16) | (g8 << 8) | b8;
+}
+
+void draw_set_line_width(void *dp, float w) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	d->line_width = w;
+}
+
+void draw_line(void *dp, float x1, float y1, float x2, float y2) {
+	stroke_segment((soft_draw_t *)dp, x1, y1, x2, y2);
+}
+
+void draw_circle_outline(void *dp, float x_c, float y_c, float radius) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	float h = stroke_width(d) / 2;
+	fill_ring(d, x_c, y_c, radius + h, radius - h);
+}
+
+void draw_circle_filled(void *dp, float x_c, float y_c, float radius) {
+	fill_ring((soft_draw_t *)dp, x_c, y_c, radius, 0);
+}
+
+void draw_rectangle_outline(void *dp, float x1, float y1, float x2, float y2) {
+	float x[5] = {x1, x2, x2, x1, x1};
+	float y[5] = {y1, y1, y2, y2, y1};
+	stroke_polyline((soft_draw_t *)dp, x, y, 5);
+}
+
+void draw_rectangle_filled(void *dp, float x1, float y1, float x2, float y2) {
+	float x[4] = {x1, x2, x2, x1};
+	float y[4] = {y1, y1, y2, y2};
+	fill_polygon((soft_draw_t *)dp, x, y, 4);
+}
+
+void draw_polygon_outline(void *dp, float *x, float *y, int num_points) {
+	stroke_polyline((soft_draw_t *)dp, x, y, num_points);
+}
+
+void draw_polygon_filled(void *dp, float *x, float *y, int num_points) {
+	fill_polygon((soft_draw_t *)dp, x, y, num_points);
+}
+
+/* There is no per-call overhead to save here, so the batched calls just
+ * loop over the single ones. */
+void draw_lines(void *dp, float *x1, float *y1, float *x2, float *y2, int count) {
+	int i;
+	for(i=0; i < count; i++) {
+		draw_line(dp, x1[i], y1[i], x2[i], y2[i]);
+	}
+}
+
+void draw_circles_outline(void *dp, float *x_c, float *y_c, float *radius, int count) {
+	int i;
+	for(i=0; i < count; i++) {
+		draw_circle_outline(dp, x_c[i], y_c[i], radius[i]);
+	}
+}
+
+void draw_circles_filled(void *dp, float *x_c, float *y_c, float *radius, int count) {
+	int i;
+	for(i=0; i < count; i++) {
+		draw_circle_filled(dp, x_c[i], y_c[i], radius[i]);
+	}
+}
+
+void draw_points(void *dp, float *x, float *y, int count) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	surface_t *s = d->target;
+	int i;
+	for(i=0; i < count; i++) {
+		int px = (int)floorf(x[i]);
+		int py = (int)floorf(y[i]);
+		if(px >= s->clip_x0 && px < s->clip_x1 && py >= s->clip_y0 && py < s->clip_y1) {
+			s->pixels[(size_t)py * s->width + px] = d->color;
+		}
+	}
+}
+
+void draw_polygons_outline(void *dp, float *x, float *y, int *counts, int num_polygons) {
+	int i;
+	for(i=0; i < num_polygons; i++) {
+		draw_polygon_outline(dp, x, y, counts[i]);
+		x += counts[i];
+		y += counts[i];
+	}
+}
+
+void draw_polygons_filled(void *dp, float *x, float *y, int *counts, int num_polygons) {
+	int i;
+	for(i=0; i < num_polygons; i++) {
+		draw_polygon_filled(dp, x, y, counts[i]);
+		x += counts[i];
+		y += counts[i];
+	}
+}
+
+void draw_get_text_dims(void *dp, char *text, float font_size, float *width_out, float *height_out) {
+	int s = font_scale(font_size);
+	int len = strlen(text);
+	*width_out = (len > 0) ? (6 * len - 1) * s : 0;
+	*height_out = 7 * s;
+}
+
+float draw_get_text_width(void *dp, char *text, float font_size) {
+	float w, h;
+	draw_get_text_dims(dp, text, font_size, &w, &h);
+	return w;
+}
+
+float draw_get_text_height(void *dp, char *text, float font_size) {
+	float w, h;
+	draw_get_text_dims(dp, text, font_size, &w, &h);
+	return h;
+}
+
+void draw_text(void *dp, char *text, float font_size, float x, float y, int anchor) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	surface_t *t = d->target;
+	float w, h;
+	draw_get_text_dims(dp, text, font_size, &w, &h);
+
+	// (x,y) is the anchor point of the text's bounding box
+	float x_left = x;
+	float y_top = y;
+	switch(anchor) {
+		case ANCHOR_TOP_MIDDLE:
+		case ANCHOR_MIDDLE_MIDDLE:
+		case ANCHOR_BOTTOM_MIDDLE:
+			x_left = x - w / 2;
+			break;
+		case ANCHOR_TOP_RIGHT:
+		case ANCHOR_MIDDLE_RIGHT:
+		case ANCHOR_BOTTOM_RIGHT:
+			x_left = x - w;
+			break;
+	}
+	switch(anchor) {
+		case ANCHOR_MIDDLE_LEFT:
+		case ANCHOR_MIDDLE_MIDDLE:
+		case ANCHOR_MIDDLE_RIGHT:
+			y_top = y - h / 2;
+			break;
+		case ANCHOR_BOTTOM_LEFT:
+		case ANCHOR_BOTTOM_MIDDLE:
+		case ANCHOR_BOTTOM_RIGHT:
+			y_top = y - h;
+			break;
+	}
+
+	int s = font_scale(font_size);
+	int x0 = (int)floorf(x_left + 0.5f);
+	int y0 = (int)floorf(y_top + 0.5f);
+	const unsigned char *c;
+	for(c = (const unsigned char *)text; *c; c++, x0 += 6 * s) {
+		if(*c < 32 || *c > 126) {
+			continue;
+		}
+		const unsigned char *glyph = font_5x7[*c - 32];
+		int gy, gx, sy;
+		for(gy=0; gy < 7; gy++) {
+			for(sy=0; sy < s; sy++) {
+				int py = y0 + gy * s + sy;
+				if(py < t->clip_y0 || py >= t->clip_y1) {
+					continue;
+				}
+				uint32_t *row = t->pixels + (size_t)py * t->width;
+				for(gx=0; gx < 5; gx++) {
+					if(!(glyph[gy] & (0x10 >> gx))) {
+						continue;
+					}
+					int px0 = x0 + gx * s;
+					int px1 = px0 + s;
+					if(px0 < t->clip_x0) px0 = t->clip_x0;
+					if(px1 > t->clip_x1) px1 = t->clip_x1;
+					if(px1 > px0) {
+						span_fill(row, px0, px1, d->color);
+					}
+				}
+			}
+		}
+	}
+}
+
+static void copy_pixels(surface_t *dst, const uint32_t *src, int src_stride, int width, int height, float x, float y) {
+	int dx = (int)floorf(x + 0.5f);
+	int dy = (int)floorf(y + 0.5f);
+	int x0 = (dx < dst->clip_x0) ? dst->clip_x0 - dx : 0;
+	int x1 = (dx + width > dst->clip_x1) ? dst->clip_x1 - dx : width;
+	int row;
+	if(x1 <= x0) {
+		return;
+	}
+	for(row=0; row < height; row++) {
+		int py = dy + row;
+		if(py < dst->clip_y0 || py >= dst->clip_y1) {
+			continue;
+		}
+		memcpy(dst->pixels + (size_t)py * dst->width + dx + x0,
+			src + (size_t)row * src_stride + x0, (x1 - x0) * sizeof(uint32_t));
+	}
+}
+
+void draw_pixels(void *dp, unsigned char *data, int stride, int width, int height, float x, float y) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	copy_pixels(d->target, (const uint32_t *)data, stride / sizeof(uint32_t), width, height, x, y);
+}
+
+/* Layers are just more framebuffers. */
+void *draw_layer_create(void *dp, int width, int height) {
+	surface_t *l = calloc(1, sizeof(surface_t));
+	assert(l != NULL);
+	surface_resize(l, width, height);
+	return (void *)l;
+}
+
+void draw_layer_destroy(void *dp, void *lp) {
+	surface_t *l = (surface_t *)lp;
+	if(l) {
+		free(l->pixels);
+		free(l);
+	}
+}
+
+void draw_layer_begin(void *dp, void *lp) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	assert(d->target == &d->canvas);
+	d->target = (surface_t *)lp;
+}
+
+void draw_layer_end(void *dp) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	d->target = &d->canvas;
+}
+
+void draw_layer_blit(void *dp, void *lp, float x, float y) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	surface_t *src = (surface_t *)lp;
+	copy_pixels(d->target, src->pixels, src->width, src->width, src->height, x, y);
+}
+
+/* Sprites are surfaces drawn white on black, so any channel of a pixel is
+ * its coverage.  They are blitted by mapping each target pixel back into
+ * the sprite, with bilinear sampling (nearest when not anti-aliasing). */
+void *draw_sprite_create(void *dp, int width, int height) {
+	surface_t *s = calloc(1, sizeof(surface_t));
+	assert(s != NULL);
+	surface_resize(s, width, height);
+	memset(s->pixels, 0, (size_t)width * height * sizeof(uint32_t));
+	return (void *)s;
+}
+
+void draw_sprite_destroy(void *dp, void *sp) {
+	draw_layer_destroy(dp, sp);
+}
+
+void draw_sprite_begin(void *dp, void *sp) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	assert(!d->in_sprite);
+	d->target = (surface_t *)sp;
+	d->sprite_saved_color = d->color;
+	d->color = 0xFFFFFF;
+	d->in_sprite = 1;
+}
+
+void draw_sprite_end(void *dp) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	assert(d->in_sprite);
+	d->target = &d->canvas;
+	d->color = d->sprite_saved_color;
+	d->in_sprite = 0;
+}
+
+static inline int sprite_texel(const surface_t *s, int x, int y) {
+	if(x < 0 || y < 0 || x >= s->width || y >= s->height) {
+		return 0;
+	}
+	return s->pixels[(size_t)y * s->width + x] & 0xFF;
+}
+
+// coverage (0..256) at sprite pixel coordinates (u, v), with pixel centers at +0.5
+static int sprite_sample(const surface_t *s, float u, float v, int smooth) {
+	if(!smooth) {
+		return (sprite_texel(s, (int)floorf(u), (int)floorf(v)) >= 128) ? 256 : 0;
+	}
+	u -= 0.5f;
+	v -= 0.5f;
+	int x = (int)floorf(u);
+	int y = (int)floorf(v);
+	float fu = u - x;
+	float fv = v - y;
+	float top = sprite_texel(s, x, y) * (1 - fu) + sprite_texel(s, x + 1, y) * fu;
+	float bottom = sprite_texel(s, x, y + 1) * (1 - fu) + sprite_texel(s, x + 1, y + 1) * fu;
+	return (int)((top * (1 - fv) + bottom * fv) * (256.0f / 255.0f) + 0.5f);
+}
+
+void draw_sprite_blit(void *dp, void *sp, float x, float y, float angle) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	const surface_t *s = (const surface_t *)sp;
+	surface_t *t = d->target;
+	float c = cosf(angle);
+	float sn = sinf(angle);
+	float hw = s->width / 2.0f;
+	float hh = s->height / 2.0f;
+	float ex = fabsf(c) * hw + fabsf(sn) * hh;
+	float ey = fabsf(sn) * hw + fabsf(c) * hh;
+	int x0 = (int)floorf(x - ex);
+	int y0 = (int)floorf(y - ey);
+	int x1 = (int)ceilf(x + ex);
+	int y1 = (int)ceilf(y + ey);
+	if(x0 < t->clip_x0) x0 = t->clip_x0;
+	if(y0 < t->clip_y0) y0 = t->clip_y0;
+	if(x1 > t->clip_x1) x1 = t->clip_x1;
+	if(y1 > t->clip_y1) y1 = t->clip_y1;
+
+	int px, py;
+	for(py=y0; py < y1; py++) {
+		uint32_t *row = t->pixels + (size_t)py * t->width;
+		float dy = py + 0.5f - y;
+		for(px=x0; px < x1; px++) {
+			float dx = px + 0.5f - x;
+			// rotate back by -angle into the sprite
+			int a = sprite_sample(s, c * dx + sn * dy + hw, -sn * dx + c * dy + hh, d->antialias);
+			if(a >= 256) {
+				row[px] = d->color;
+			} else if(a > 0) {
+				row[px] = blend(row[px], d->color, a);
+			}
+		}
+	}
+}
+
+/* PNG output ***********************************************************
+ *
+ * Image drawers don't depend on any image library, so PNGs are written
+ * here directly, using uncompressed (stored) deflate blocks. */
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+	uint32_t n, k;
+	if(crc_table[1]) {
+		return;
+	}
+	for(n=0; n < 256; n++) {
+		uint32_t c = n;
+		for(k=0; k < 8; k++) {
+			c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		}
+		crc_table[n] = c;
+	}
+}
+
+static uint32_t crc_update(uint32_t crc, const unsigned char *buf, size_t len) {
+	size_t i;
+	for(i=0; i < len; i++) {
+		crc = crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static int png_chunk(FILE *fp, const char *type, const unsigned char *data, size_t len) {
+	unsigned char hdr[8];
+	unsigned char crc_buf[4];
+	put_u32(hdr, len);
+	memcpy(hdr + 4, type, 4);
+	uint32_t crc = crc_update(0xFFFFFFFF, hdr + 4, 4);
+	crc = crc_update(crc, data, len);
+	put_u32(crc_buf, crc ^ 0xFFFFFFFF);
+	return fwrite(hdr, 1, 8, fp) == 8 && fwrite(data, 1, len, fp) == len &&
+		fwrite(crc_buf, 1, 4, fp) == 4 ? 0 : -1;
+}
+
+int draw_image_write_png(void *dp, const char *filename) {
+	soft_draw_t *d = (soft_draw_t *)dp;
+	surface_t *s = &d->canvas;
+	crc_init();
+
+	// raw scanlines: a filter byte (0 = none) and RGB for each row
+	size_t row_len = 1 + 3 * (size_t)s->width;
+	size_t raw_len = row_len * s->height;
+	size_t num_blocks = (raw_len + 65534) / 65535;
+	if(num_blocks == 0) {
+		num_blocks = 1;
+	}
+	size_t z_len = 2 + raw_len + 5 * num_blocks + 4;
+	unsigned char *raw = malloc(raw_len);
+	unsigned char *z = malloc(z_len);
+	if(raw == NULL || z == NULL) {
+		free(raw);
+		free(z);
+		return -1;
+	}
+	unsigned char *p = raw;
+	int row, col;
+	for(row=0; row < s->height; row++) {
+		const uint32_t *px = s->pixels + (size_t)row * s->width;
+		*p++ = 0;
+		for(col=0; col < s->width; col++) {
+			*p++ = px[col] >> 16;
+			*p++ = px[col] >> 8;
+			*p++ = px[col];
+		}
+	}
+
+	// zlib stream of stored blocks, then the adler32 of the raw data
+	unsigned char *q = z;
+	*q++ = 0x78;
+	*q++ = 0x01;
+	size_t off = 0;
+	uint32_t a = 1, b = 0;
+	do {
+		size_t n = raw_len - off;
+		if(n > 65535) {
+			n = 65535;
+		}
+		*q++ = (off + n == raw_len) ? 1 : 0;
+		*q++ = n & 0xFF;
+		*q++ = n >> 8;
+		*q++ = ~n & 0xFF;
+		*q++ = (~n >> 8) & 0xFF;
+		memcpy(q, raw + off, n);
+		size_t i;
+		for(i=0; i < n; i++) {
+			a = (a + q[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		q += n;
+		off += n;
+	} while(off < raw_len);
+	put_u32(q, (b << 16) | a);
+	q += 4;
+
+	unsigned char ihdr[13];
+	put_u32(ihdr, s->width);
+	put_u32(ihdr + 4, s->height);
+	ihdr[8] = 8;  // bits per channel
+	ihdr[9] = 2;  // RGB
+	ihdr[10] = 0; // deflate
+	ihdr[11] = 0; // adaptive filtering
+	ihdr[12] = 0; // no interlace
+
+	int ret = -1;
+	FILE *fp = fopen(filename, "wb");
+	if(fp) {
+		static const unsigned char sig[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+		if(fwrite(sig, 1, 8, fp) == 8 &&
+			!png_chunk(fp, "IHDR", ihdr, sizeof(ihdr)) &&
+			!png_chunk(fp, "IDAT", z, q - z) &&
+			!png_chunk(fp, "IEND", NULL, 0)) {
+			ret = 0;
+		}
+		if(fclose(fp)) {
+			ret = -1;
+		}
+	}
+	free(raw);
+	free(z);
+	return ret;
+}
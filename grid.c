@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "grid.h"
+
+// cells per side are limited to this (about sqrt(count) are used)
+#define MAX_GRID_DIM 256
+
+// a box touching more cells than this goes on the big list instead
+#define MAX_CELLS_PER_BOX 16
+
+static void *grow(void *p, int *capacity, int needed, size_t elem_size) {
+	if(needed <= *capacity) {
+		return p;
+	}
+	int new_capacity = (*capacity > 0) ? *capacity : 64;
+	while(new_capacity < needed) {
+		new_capacity *= 2;
+	}
+	p = realloc(p, new_capacity * elem_size);
+	if(p == NULL) {
+		fprintf(stderr, "Error expanding spatial grid!\n");
+		exit(-1);
+	}
+	*capacity = new_capacity;
+	return p;
+}
+
+void grid_init(grid_t *g) {
+	memset(g, 0, sizeof(grid_t));
+}
+
+void grid_destroy(grid_t *g) {
+	free(g->cell_start);
+	free(g->items);
+	free(g->big);
+	free(g->stamp);
+	free(g->result);
+	grid_init(g);
+}
+
+static int clamp_cell(double v, int n) {
+	if(!(v > 0)) {
+		return 0;
+	}
+	if(v >= n - 1) {
+		return n - 1;
+	}
+	return (int)v;
+}
+
+static void grid_cell_range(const grid_t *g, const bbox_t *b, int *cx0, int *cy0, int *cx1, int *cy1) {
+	*cx0 = clamp_cell((b->x_min - g->x0) / g->cell_w, g->nx);
+	*cx1 = clamp_cell((b->x_max - g->x0) / g->cell_w, g->nx);
+	*cy0 = clamp_cell((b->y_min - g->y0) / g->cell_h, g->ny);
+	*cy1 = clamp_cell((b->y_max - g->y0) / g->cell_h, g->ny);
+}
+
+static bool grid_is_big(int cx0, int cy0, int cx1, int cy1) {
+	return (cx1 - cx0 + 1) * (cy1 - cy0 + 1) > MAX_CELLS_PER_BOX;
+}
+
+void grid_build(grid_t *g, const bbox_t *boxes, int count) {
+	int i, c, cx, cy, cx0, cy0, cx1, cy1;
+
+	g->num_big = 0;
+	g->nx = g->ny = 0;
+	if(count == 0) {
+		return;
+	}
+
+	bbox_t ext = boxes[0];
+	for(i=1; i<count; i++) {
+		if(boxes[i].x_min < ext.x_min) ext.x_min = boxes[i].x_min;
+		if(boxes[i].y_min < ext.y_min) ext.y_min = boxes[i].y_min;
+		if(boxes[i].x_max > ext.x_max) ext.x_max = boxes[i].x_max;
+		if(boxes[i].y_max > ext.y_max) ext.y_max = boxes[i].y_max;
+	}
+	int dim = (int)ceil(sqrt(count));
+	if(dim > MAX_GRID_DIM) {
+		dim = MAX_GRID_DIM;
+	}
+	g->nx = g->ny = dim;
+	g->x0 = ext.x_min;
+	g->y0 = ext.y_min;
+	g->cell_w = (ext.x_max - ext.x_min) / dim;
+	g->cell_h = (ext.y_max - ext.y_min) / dim;
+	if(!(g->cell_w > 0)) g->cell_w = 1.0;
+	if(!(g->cell_h > 0)) g->cell_h = 1.0;
+
+	// count the entries in each cell (in cell_start[c+1])...
+	int num_cells = g->nx * g->ny;
+	g->cell_start = grow(g->cell_start, &g->cell_start_capacity, num_cells + 1, sizeof(int));
+	memset(g->cell_start, 0, (num_cells + 1) * sizeof(int));
+	for(i=0; i<count; i++) {
+		grid_cell_range(g, &boxes[i], &cx0, &cy0, &cx1, &cy1);
+		if(grid_is_big(cx0, cy0, cx1, cy1)) {
+			g->big = grow(g->big, &g->big_capacity, g->num_big + 1, sizeof(int));
+			g->big[g->num_big++] = i;
+			continue;
+		}
+		for(cy=cy0; cy<=cy1; cy++) {
+			for(cx=cx0; cx<=cx1; cx++) {
+				g->cell_start[cy * g->nx + cx + 1]++;
+			}
+		}
+	}
+
+	// ...turn the counts into offsets...
+	for(c=0; c<num_cells; c++) {
+		g->cell_start[c + 1] += g->cell_start[c];
+	}
+	g->items = grow(g->items, &g->items_capacity, g->cell_start[num_cells], sizeof(int));
+
+	// ...and fill the cells.  cell_start[c] is used as the fill cursor, which
+	// leaves it at the start of cell c+1, so shift back afterwards.
+	for(i=0; i<count; i++) {
+		grid_cell_range(g, &boxes[i], &cx0, &cy0, &cx1, &cy1);
+		if(grid_is_big(cx0, cy0, cx1, cy1)) {
+			continue;
+		}
+		for(cy=cy0; cy<=cy1; cy++) {
+			for(cx=cx0; cx<=cx1; cx++) {
+				g->items[g->cell_start[cy * g->nx + cx]++] = i;
+			}
+		}
+	}
+	for(c=num_cells; c>0; c--) {
+		g->cell_start[c] = g->cell_start[c - 1];
+	}
+	g->cell_start[0] = 0;
+
+	g->stamp = grow(g->stamp, &g->stamp_capacity, count, sizeof(unsigned int));
+	memset(g->stamp, 0, count * sizeof(unsigned int));
+	g->query = 0;
+	g->result = grow(g->result, &g->result_capacity, count, sizeof(int));
+}
+
+static int int_compare(const void *a, const void *b) {
+	return *(const int *)a - *(const int *)b;
+}
+
+int grid_query(grid_t *g, const bbox_t *boxes, const bbox_t *rect, int **result) {
+	int i, n = 0;
+	*result = g->result;
+	if(g->nx == 0) {
+		return 0;
+	}
+
+	if(++g->query == 0) {
+		memset(g->stamp, 0, g->stamp_capacity * sizeof(unsigned int));
+		g->query = 1;
+	}
+
+	for(i=0; i<g->num_big; i++) {
+		int b = g->big[i];
+		if(bbox_overlap(&boxes[b], rect)) {
+			g->stamp[b] = g->query;
+			g->result[n++] = b;
+		}
+	}
+
+	int cx, cy, cx0, cy0, cx1, cy1;
+	grid_cell_range(g, rect, &cx0, &cy0, &cx1, &cy1);
+	for(cy=cy0; cy<=cy1; cy++) {
+		for(cx=cx0; cx<=cx1; cx++) {
+			int c = cy * g->nx + cx;
+			int k;
+			for(k=g->cell_start[c]; k<g->cell_start[c + 1]; k++) {
+				int b = g->items[k];
+				if(g->stamp[b] == g->query) {
+					continue;
+				}
+				g->stamp[b] = g->query;
+				if(bbox_overlap(&boxes[b], rect)) {
+					g->result[n++] = b;
+				}
+			}
+		}
+	}
+
+	qsort(g->result, n, sizeof(int), int_compare);
+	return n;
+}
@@ -0,0 +1,58 @@
+#ifndef __GRID_H__
+#define __GRID_H__
+
+#include <stdbool.h>
+
+typedef struct {
+  double x_min;
+  double y_min;
+  double x_max;
+  double y_max;
+} bbox_t;
+
+static inline bool bbox_overlap(const bbox_t *a, const bbox_t *b) {
+  return a->x_min <= b->x_max && b->x_min <= a->x_max &&
+    a->y_min <= b->y_max && b->y_min <= a->y_max;
+}
+
+/* A uniform grid over a set of bounding boxes, used to find the boxes that
+ * overlap a rectangle without testing every one of them.  Each box is
+ * listed in every cell it touches, except boxes that span a large part of
+ * the grid, which are kept on a separate list and tested on every query. */
+typedef struct {
+  double x0;
+  double y0;
+  double cell_w;
+  double cell_h;
+  int nx;
+  int ny;
+
+  int *cell_start; // nx*ny + 1 offsets into items (cell c is items[cell_start[c]..cell_start[c+1]])
+  int cell_start_capacity;
+  int *items;
+  int items_capacity;
+
+  int *big;
+  int num_big;
+  int big_capacity;
+
+  // query scratch
+  unsigned int *stamp; // per box; == query when already collected
+  int stamp_capacity;
+  unsigned int query;
+  int *result;
+  int result_capacity;
+} grid_t;
+
+void grid_init(grid_t *g);
+void grid_destroy(grid_t *g);
+
+/* (Re)build the grid for count boxes.  Buffers are kept between builds. */
+void grid_build(grid_t *g, const bbox_t *boxes, int count);
+
+/* Find the boxes overlapping rect.  The indices are returned in ascending
+ * order (so callers can keep their drawing order) in a buffer owned by the
+ * grid, valid until the next query. */
+int grid_query(grid_t *g, const bbox_t *boxes, const bbox_t *rect, int **result);
+
+#endif
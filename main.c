@@ -6,14 +6,21 @@
 #include <stdint.h>
 #include <assert.h>
 #include <ctype.h>
+#include <stddef.h>
 
 #include <gtk/gtk.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
 
 #include "draw.h"
+#include "dlist.h"
+#include "grid.h"
 #include "cmdline.h"
 
 #include <libxml/parser.h>
@@ -25,12 +32,8 @@
 	#include <jbplot.h>
 #endif
 
-#define MAX_BODIES     500
-#define MAX_CONNECTORS 500
-#define MAX_INPUT_MAPS 100
-#define MAX_GROUNDS 100
-
 #define INIT_FRAMES_CAPACITY 1000
+#define INIT_SCENE_CAPACITY 64
 
 #define PRINT_DEBUG 1
 #define PRINT_DEBUG2 1
@@ -87,11 +90,20 @@ typedef struct _transform_t {
 	double A[2][2];
 } transform_t;
 
-typedef struct _body_t {
-	body_type_enum type;
+/* Per-body values that are driven by the input data.  These live in one
+ * packed array (scene_state_t.body_state), indexed by body_t.index, so that
+ * the scatter plan can write a whole frame with a single flat loop. */
+typedef struct {
 	double x;
 	double y;
 	double theta;
+} body_state_t;
+
+#define BODY_STATE_SLOTS (sizeof(body_state_t) / sizeof(double))
+
+typedef struct _body_t {
+	body_type_enum type;
+	int index; // position in app_data.bodies[] (and the scene_state_t arrays)
 	struct _body_t *xy_parent;
 	struct _body_t *theta_parent;
 
@@ -107,13 +119,56 @@ typedef struct _body_t {
 	bool show_body_frame;
 	bool show_name;
 	bool show_id;
+	char *label; // name and/or id as shown, NULL if neither is
+	int trail_length; // frames of motion trail to draw, 0 for none
+	double trail_x; // point the trail follows, in the body frame
+	double trail_y;
 	bool filled;
 	double line_width;
 	color_t color;
-
-	transform_t trans_shape_to_gnd;
 } body_t;
 
+/* The parts of a body's configuration that are needed every frame to
+ * compute its transforms, packed next to each other (one per body index) so
+ * the transform pass doesn't have to visit the body_t structs at all. */
+typedef struct {
+	int xy_parent; // body index, or -1 for ground
+	int theta_parent; // body index, or -1 for ground
+	transform_t shape_to_body;
+	bbox_t local_bbox; // bounding box of the shape, in the shape frame
+} body_link_t;
+
+/* Ring buffer of where a body's trail point was over its last
+ * trail_length frames, in ground coordinates. */
+typedef struct {
+	double *x;
+	double *y;
+	int start; // oldest point
+	int count;
+} trail_t;
+
+/* All per-frame (hot) data, stored as contiguous arrays indexed by
+ * body_t.index.  The body_t structs only hold (cold) configuration. */
+typedef struct {
+	int num_bodies;
+	int capacity;
+	body_state_t *body_state;  // inputs, written by the scatter plan
+	double *theta_to_gnd;      // accumulated theta along the theta_parent chain
+	transform_t *frame_to_gnd; // body frame -> ground frame
+	transform_t *shape_to_gnd; // shape frame -> ground frame
+	bbox_t *bbox;              // bounding box of each shape, in the ground frame
+	unsigned int generation;   // bumped every time the transforms are recomputed
+
+	grid_t grid;               // spatial index over the static bodies' boxes, for culling
+	bbox_t *static_bbox;       // those boxes, in app_data.static_bodies order
+	bool grid_valid;
+	int *visible_bodies;       // scratch for render_scene()
+
+	trail_t *trails;           // one per app_data.trail_bodies entry, allocated on first use
+	int trail_frame;           // frame the trails end at
+	bool trails_valid;         // false after a seek, until rebuilt
+} scene_state_t;
+
 void transform_point(transform_t *t, double x, double y, double *x_out, double *y_out) {
 	*x_out = t->x_offset + t->A[0][0] * x + t->A[0][1] * y;
 	*y_out = t->y_offset + t->A[1][0] * x + t->A[1][1] * y;
@@ -176,12 +231,27 @@ typedef struct {
 } block_t;
 
 
+/* A simplified copy of a polygon's nodes, good to within LOD_TOLERANCE_PX
+ * at any scale in its band. */
+typedef struct {
+	int band; // floor(log2(pixels per user unit))
+	int node_count;
+	double *node_x;
+	double *node_y;
+} polygon_lod_t;
+
+#define POLYGON_LOD_SLOTS 4
+
 typedef struct {
 	body_t body;
 	int node_count;
 	double *node_x;
 	double *node_y;
 	bool node_owner;
+
+	polygon_lod_t lod[POLYGON_LOD_SLOTS]; // recently used levels of detail
+	int num_lod;
+	int lod_next; // slot to replace when all are in use
 } polygon_t;
 
 typedef enum {
@@ -206,6 +276,7 @@ typedef struct {
 	color_t color;
 	bool show_name;
 	bool show_id;
+	char *label; // name and/or id as shown, NULL if neither is
 } connector_t;
 
 typedef enum {
@@ -229,13 +300,38 @@ typedef enum {
 
 typedef struct _input_map_t {
 	int field_num; // 1-based
-	void *dest; // where to write the value (a field of a body_t)
+	int dest_index; // double slot in scene_state_t.body_state to write to (-1 for time)
 	data_type_enum data_type;
 	int frame_byte_offset;
+	bool plot; // show in the plot pane (not for time)
 } input_map_t;
 
+/* A scatter plan is the compiled form of the input maps: for each data type,
+ * a contiguous list of (frame byte offset, body state slot) pairs.  Applying
+ * a frame is then a tight copy loop with no per-map switch. */
+typedef struct {
+	int count;
+	int *src; // byte offset into the frame
+	int *dst; // slot index into the packed body state array
+} scatter_group_t;
+
+typedef struct {
+	scatter_group_t f64;
+} scatter_plan_t;
+
 typedef char *frame_ptr_t;
 
+/* Reads frames from the datafile a line at a time. */
+typedef struct {
+	FILE *fp;
+	bool follow; // the file is still being written: leave a partial last line for the next read
+	char **fields;
+	int max_fields;
+	char *line;
+	size_t line_capacity;
+	unsigned int line_num;
+} data_reader_t;
+
 frame_ptr_t frame_alloc(int size) {
 	frame_ptr_t fp;
 	fp = malloc(size);
@@ -246,41 +342,253 @@ frame_ptr_t frame_alloc(int size) {
 	return fp;
 }
 
+typedef struct {
+	double min;
+	double max;
+} range_t;
+
+/* Mapping from user coordinates to pixel coordinates for a canvas:
+ *    x_px = x_m * x_user + x_b
+ *    y_px = y_m * y_user + y_b
+ */
+typedef struct {
+	float width;
+	float height;
+	range_t x_range;
+	range_t y_range;
+	float x_m, x_b;
+	float y_m, y_b;
+	float lod_scale; // polygon level of detail to draw at (see polygon_lod_nodes()), 0 for full detail
+} view_t;
+
+// damaged areas are merged down to at most this many rectangles
+#define MAX_DAMAGE_RECTS 8
+
+/* Parts of the canvas that need repainting, in pixels. */
+typedef struct {
+	bbox_t rects[MAX_DAMAGE_RECTS];
+	int count;
+	bool all; // the whole canvas
+} damage_t;
+
+/* Where each moving thing was drawn in the last frame of a scene, to find
+ * what a new frame changes. */
+typedef struct {
+	bbox_t *body_px; // per body
+	bbox_t *connector_px; // per connector
+	bbox_t trails_px; // all trails together
+	bool overlay;
+	int quality;
+	bool valid;
+	view_t view;
+} damage_tracker_t;
+
+/* What the last recorded frame drew and what culling skipped. */
+typedef struct {
+	int bodies_drawn;
+	int bodies_culled;
+	int bodies_subpixel; // drawn as a single point
+	int bodies_sprite; // drawn from a sprite
+	int polygon_nodes_skipped; // removed by level of detail simplification
+	int connectors_drawn;
+	int connectors_culled;
+	int grounds_drawn;
+	int grounds_culled;
+	double seek_latency_ms; // last slider seek, from the first event to the frame being shown
+	int seeks_dropped; // seek targets replaced by a newer one before being drawn
+	double frame_ms; // time to evaluate and draw the last frame
+	int quality; // DRAW_QUALITY_* the last frame was drawn at
+} render_stats_t;
+
+// static content is cached in square tiles of this size, aligned to a
+// per-zoom pixel grid so they can be reused as the view pans.  Tiles are
+// blitted at whole pixels and drawn with the view's sub-pixel offset, so
+// they line up exactly with what's drawn directly.
+#define TILE_PX 256
+#define MAX_TILES 96
+
+typedef struct {
+	draw_layer_ptr layer; // NULL for an unused slot
+	double scale; // view x_m the tile was drawn at
+	float fx, fy; // sub-pixel offset of the view it was drawn for (see tile_origin())
+	int tx, ty; // position on the grid, in tiles
+	unsigned int last_used;
+} tile_t;
+
+typedef struct {
+	tile_t tiles[MAX_TILES];
+	unsigned int frame;
+	dlist_t dl; // scratch for drawing a tile
+	render_stats_t stats;
+} tile_cache_t;
+
+// bodies up to this size on screen (in pixels, across) are drawn from sprites
+#define SPRITE_MAX_PX 64
+#define MAX_SPRITES 512
+
+typedef struct {
+	draw_sprite_ptr sprite;
+	body_t *shape; // the body it was drawn for; bodies with the same shape share it
+	int size; // width and height, in pixels
+} sprite_t;
+
+/* Pre-drawn body shapes, for one zoom level.  Each body is matched to a
+ * sprite (or to none, if it's too big) the first time it's drawn. */
+typedef struct {
+	draw_ptr dp; // new sprites are drawn with this
+	bool unsupported; // the backend has no sprites
+	double scale; // view x_m the sprites were drawn at
+	sprite_t sprites[MAX_SPRITES];
+	int num_sprites;
+	int *body_sprite; // per body: index into sprites, SPRITE_NONE or SPRITE_UNKNOWN
+	dlist_t dl; // scratch for drawing a sprite
+	render_stats_t stats;
+} sprite_cache_t;
+
+typedef struct _render_thread_t render_thread_t;
+
+#if USE_PLOTS
+/* The min and max of a run of frames, as frame indices. */
+typedef struct {
+	int lo;
+	int hi;
+} plot_run_t;
+
+/* One mapped column plotted against time.  The plot is fed min/max pairs
+ * of runs of frames, about one pair per pixel of its width, so it has the
+ * same outline as the full data but redraws in time independent of the
+ * number of frames.  Frames are folded into the runs as they arrive and
+ * only finished runs are appended to the trace.  When there get to be too
+ * many runs, neighbours are merged (doubling the run length) and the trace
+ * is refilled from the runs, never from the frames. */
+typedef struct {
+	input_map_t *map;
+	GtkWidget *plot;
+	trace_handle trace;
+	int width; // pixels, 0 until the plot has a size
+	int next_frame; // first frame not folded in yet
+	int run_frames; // frames per run, a power of two
+	plot_run_t *runs; // finished runs, oldest first
+	int num_runs;
+	int num_fed; // runs already in the trace
+	plot_run_t tail; // the run being filled
+	int tail_frames;
+} plot_channel_t;
+#endif
+
+typedef struct {
+	int frame_index;
+	bool ready; // pixels have been filled in
+	uint32_t *pixels; // width * height, as from draw_image_get_data()
+} thumb_t;
+
+typedef struct _filmstrip_worker_t filmstrip_worker_t;
+
+/* Thumbnails of evenly spaced frames, shown under the time slider. */
+typedef struct {
+	GtkWidget *widget; // NULL if there's no filmstrip
+	draw_ptr drawer;
+	int width, height; // of a thumbnail
+	thumb_t *thumbs;
+	int num_thumbs;
+	int *order; // indices into thumbs, coarsest spacing first
+	int next_job; // into order
+	bool quit;
+	bool redraw_pending;
+	filmstrip_worker_t *workers;
+	int num_workers;
+	pthread_mutex_t lock;
+} filmstrip_t;
+
 typedef struct {
 	GtkWidget *canvas;
 	GtkWidget *slider;
+	filmstrip_t filmstrip;
 	draw_ptr drawer;
+	render_thread_t *render_thread; // NULL when drawing in the main loop
+	dlist_t dlist; // the last evaluated frame, replayed on expose
+	bool dlist_valid;
+	unsigned int dlist_generation;
+	view_t dlist_view;
+	int dlist_quality;
+	dlist_t bg_dlist; // static content (background, axes, grounds), drawn directly until tiles are ready
+	bool bg_valid;
+	view_t bg_view;
+	tile_cache_t tiles; // static content, when drawing in the main loop
+	sprite_cache_t sprites; // for the scene, when drawing in the main loop
+	guint tiles_idle; // fills in missing tiles, 0 if none
+	bool dragging;
+	double drag_x, drag_y; // last pointer position while panning
+	render_stats_t stats;
+	bool show_overlay;
+	int quality; // DRAW_QUALITY_* for the moving part of the scene; static content is always drawn at best
+	double best_frame_ms; // smoothed time to draw a frame at best quality
+	gint64 last_motion; // when the frame last changed from playback or a seek
+	guint quality_timeout; // waits for motion to stop, 0 if none
+	damage_tracker_t damage; // for app_data.scene, when drawing in the main loop
+	guint seek_idle; // coalesced seek waiting to run, 0 if none
+	int seeks_queued; // slider events since the last seek ran
+	gint64 seek_start; // time of the oldest seek not yet shown, 0 if none
 	GtkWidget *playback_state;
 	GtkWidget *time;
 
 	#if USE_PLOTS
 	GtkWidget *h_pane;
 	GtkWidget *plot_win;
+	plot_channel_t *plots;
+	int num_plots;
 	#endif
 } gui_t;
 
+/* Open-addressed hash table from body id to body index.  Slots hold
+ * (index + 1), so 0 marks an empty slot. */
 typedef struct {
-	double min;
-	double max;
-} range_t;
+	int *slots;
+	int capacity; // always a power of 2
+	int count;
+} body_id_index_t;
 
 typedef struct _app_data_t {
-	body_t *bodies[MAX_BODIES];
+	body_t **bodies;
+	body_link_t *body_links;
 	int num_bodies;
+	int bodies_capacity;
+	scene_state_t scene;
+	body_id_index_t body_ids;
+	int next_auto_id;
 
-	connector_t *connectors[MAX_CONNECTORS];
+	connector_t **connectors;
 	int num_connectors;
-
-	ground_t *grounds[MAX_GROUNDS];
+	int connectors_capacity;
+
+	int *trail_bodies; // indices of the bodies with a trail
+	int num_trails;
+	int trails_capacity;
+	int max_trail_length;
+	int *trail_chain; // the trail bodies and the bodies they hang from, in index order
+	int num_trail_chain;
+	int *static_bodies; // bodies no input map moves (even through a parent), in index order
+	int num_static_bodies;
+	int *moving_bodies; // the rest
+	int num_moving_bodies;
+
+	ground_t **grounds;
 	int num_grounds;
+	int grounds_capacity;
 
-	input_map_t *input_maps[MAX_INPUT_MAPS];
+	input_map_t **input_maps;
 	int num_input_maps;
+	int input_maps_capacity;
+	scatter_plan_t plan;
 
 	frame_ptr_t *frames;	
 	int num_frames;
 	int frames_capacity;
 	int bytes_per_frame;
+	pthread_rwlock_t frames_lock; // read by other threads using frames, written to grow it
+	data_reader_t reader;
+	bool follow; // frames are appended as the datafile grows
+	double plot_window; // plots show this much time up to the newest frame, 0 for all of it
 
 	bool paused;
 	
@@ -297,16 +605,137 @@ typedef struct _app_data_t {
 
 	range_t x_range;
 	range_t y_range;
+	range_t home_x_range; // as configured, restored by a double-click
+	range_t home_y_range;
+	double max_line_width; // widest body outline or connector, for the cull margin
 
 } app_data_t;
 
 static app_data_t app_data;
 
+#define BODY_STATE(b) (&app_data.scene.body_state[(b)->index])
+#define BODY_TRANS(ss, b) (&(ss)->shape_to_gnd[(b)->index])
+
+static void *array_grow(void *array, int *capacity, size_t elem_size, const char *what) {
+	int new_capacity = (*capacity > 0) ? (*capacity * 2) : INIT_SCENE_CAPACITY;
+	array = realloc(array, new_capacity * elem_size);
+	if(array == NULL) {
+		ERROR("Error expanding size of '%s'.\n", what);
+		exit(-1);
+	}
+	*capacity = new_capacity;
+	return array;
+}
+
+static void body_id_index_init(body_id_index_t *idx, int capacity) {
+	idx->slots = calloc(capacity, sizeof(idx->slots[0]));
+	if(idx->slots == NULL) {
+		ERROR("Error allocating body id index\n");
+		exit(-1);
+	}
+	idx->capacity = capacity;
+	idx->count = 0;
+}
+
+static unsigned int hash_int(int key) {
+	uint32_t h = (uint32_t)key;
+	h ^= h >> 16;
+	h *= 0x7feb352d;
+	h ^= h >> 15;
+	h *= 0x846ca68b;
+	h ^= h >> 16;
+	return h;
+}
+
+static void scene_state_reserve(scene_state_t *ss, int capacity);
+
+/* Make dst an independent copy of src (which must be fully evaluated or
+ * at least hold the configured initial state), for rendering on another
+ * thread. */
+static void scene_state_clone(scene_state_t *dst, const scene_state_t *src) {
+	memset(dst, 0, sizeof(*dst));
+	grid_init(&dst->grid);
+	scene_state_reserve(dst, src->num_bodies > 0 ? src->num_bodies : 1);
+	dst->num_bodies = src->num_bodies;
+	memcpy(dst->body_state, src->body_state, src->num_bodies * sizeof(src->body_state[0]));
+	memcpy(dst->theta_to_gnd, src->theta_to_gnd, src->num_bodies * sizeof(src->theta_to_gnd[0]));
+	memcpy(dst->frame_to_gnd, src->frame_to_gnd, src->num_bodies * sizeof(src->frame_to_gnd[0]));
+	memcpy(dst->shape_to_gnd, src->shape_to_gnd, src->num_bodies * sizeof(src->shape_to_gnd[0]));
+	memcpy(dst->bbox, src->bbox, src->num_bodies * sizeof(src->bbox[0]));
+	dst->generation = src->generation;
+}
+
+static void scene_state_free(scene_state_t *ss) {
+	int i;
+	if(ss->trails) {
+		for(i=0; i < app_data.num_trails; i++) {
+			free(ss->trails[i].x);
+			free(ss->trails[i].y);
+		}
+		free(ss->trails);
+	}
+	free(ss->body_state);
+	free(ss->theta_to_gnd);
+	free(ss->frame_to_gnd);
+	free(ss->shape_to_gnd);
+	free(ss->bbox);
+	grid_destroy(&ss->grid);
+	free(ss->static_bbox);
+	free(ss->visible_bodies);
+	memset(ss, 0, sizeof(*ss));
+}
+
+static void scene_state_reserve(scene_state_t *ss, int capacity) {
+	if(capacity <= ss->capacity) {
+		return;
+	}
+	ss->body_state = realloc(ss->body_state, capacity * sizeof(ss->body_state[0]));
+	ss->theta_to_gnd = realloc(ss->theta_to_gnd, capacity * sizeof(ss->theta_to_gnd[0]));
+	ss->frame_to_gnd = realloc(ss->frame_to_gnd, capacity * sizeof(ss->frame_to_gnd[0]));
+	ss->shape_to_gnd = realloc(ss->shape_to_gnd, capacity * sizeof(ss->shape_to_gnd[0]));
+	ss->bbox = realloc(ss->bbox, capacity * sizeof(ss->bbox[0]));
+	if(!ss->body_state || !ss->theta_to_gnd || !ss->frame_to_gnd || !ss->shape_to_gnd || !ss->bbox) {
+		ERROR("Error expanding size of scene state.\n");
+		exit(-1);
+	}
+	ss->capacity = capacity;
+}
+
 void app_data_init(app_data_t *d) {
+	d->bodies = NULL;
+	d->body_links = NULL;
 	d->num_bodies = 0;
+	d->bodies_capacity = 0;
+	memset(&d->scene, 0, sizeof(d->scene));
+	grid_init(&d->scene.grid);
+	body_id_index_init(&d->body_ids, 2 * INIT_SCENE_CAPACITY);
+	d->next_auto_id = 1;
+
+	d->connectors = NULL;
 	d->num_connectors = 0;
+	d->connectors_capacity = 0;
+
+	d->trail_bodies = NULL;
+	d->num_trails = 0;
+	d->trails_capacity = 0;
+	d->max_trail_length = 0;
+	d->trail_chain = NULL;
+	d->num_trail_chain = 0;
+	d->static_bodies = NULL;
+	d->num_static_bodies = 0;
+	d->moving_bodies = NULL;
+	d->num_moving_bodies = 0;
+
+	d->grounds = NULL;
 	d->num_grounds = 0;
+	d->grounds_capacity = 0;
+
+	d->input_maps = NULL;
 	d->num_input_maps = 0;
+	d->input_maps_capacity = 0;
+	d->plan.f64.count = 0;
+	d->plan.f64.src = NULL;
+	d->plan.f64.dst = NULL;
 
 	d->frames = malloc(INIT_FRAMES_CAPACITY * sizeof(frame_ptr_t));
 	if(d->frames == NULL) {
@@ -316,6 +745,9 @@ void app_data_init(app_data_t *d) {
 	d->frames_capacity = INIT_FRAMES_CAPACITY;
 	d->num_frames = 0;
 	d->bytes_per_frame = 0;
+	pthread_rwlock_init(&d->frames_lock, NULL);
+	d->follow = false;
+	d->plot_window = 0;
 
 	d->time = 0.0;
 	d->explicit_time = false;
@@ -327,14 +759,18 @@ void app_data_init(app_data_t *d) {
 	d->x_range.max = +10.0;
 	d->y_range.min = -10.0;
 	d->y_range.max = +10.0;
+	d->max_line_width = 0.0;
 }
 
 int body_init(body_t *self, body_type_enum type) {
 	self->type = type;
 
-	self->x = 0.0;
-	self->y = 0.0;
-	self->theta = 0.0;
+	// a body occupies the next slot if (and only if) it parses successfully
+	self->index = app_data.num_bodies;
+	body_state_t *state = BODY_STATE(self);
+	state->x = 0.0;
+	state->y = 0.0;
+	state->theta = 0.0;
 	self->xy_parent = NULL;
 	self->theta_parent = NULL;
 
@@ -350,6 +786,10 @@ int body_init(body_t *self, body_type_enum type) {
 	self->show_body_frame = false;
 	self->show_name = false;
 	self->show_id = false;
+	self->label = NULL;
+	self->trail_length = 0;
+	self->trail_x = 0.0;
+	self->trail_y = 0.0;
 	self->filled = true;
 	self->line_width = 1.0;
 	self->color = COLOR_BLACK;
@@ -366,8 +806,19 @@ ball_t *ball_alloc(void) {
 	return ball;
 }
 
+static void polygon_lod_clear(polygon_t *self) {
+	int i;
+	for(i=0; i<self->num_lod; i++) {
+		free(self->lod[i].node_x);
+		free(self->lod[i].node_y);
+	}
+	self->num_lod = 0;
+	self->lod_next = 0;
+}
+
 void polygon_dealloc(polygon_t *self) {
 	if(self) {
+		polygon_lod_clear(self);
 		free(self);
 	}
 }
@@ -468,6 +919,9 @@ int connector_init(connector_t *self) {
 	self->y2 = 0.0;
 	self->name = "";
 	self->id = -1;
+	self->show_name = false;
+	self->show_id = false;
+	self->label = NULL;
 	return 0;
 }
 
@@ -478,28 +932,216 @@ int polygon_init(polygon_t *self)
 	self->node_x = NULL;
 	self->node_y = NULL;
 	self->node_owner = false;
+	self->num_lod = 0;
+	self->lod_next = 0;
 	return 0;
 }
 
+body_t *lookup_body_by_id(int id) {
+	body_id_index_t *idx = &app_data.body_ids;
+	unsigned int mask = idx->capacity - 1;
+	unsigned int i = hash_int(id) & mask;
+	while(idx->slots[i] != 0) {
+		body_t *body = app_data.bodies[idx->slots[i] - 1];
+		if(body->id == id) {
+			return body;
+		}
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+static void body_id_index_insert(body_id_index_t *idx, int id, int body_index) {
+	unsigned int mask = idx->capacity - 1;
+	unsigned int i = hash_int(id) & mask;
+	while(idx->slots[i] != 0) {
+		if(app_data.bodies[idx->slots[i] - 1]->id == id) {
+			return; // duplicate id: the first body with this id wins
+		}
+		i = (i + 1) & mask;
+	}
+	idx->slots[i] = body_index + 1;
+	idx->count++;
+}
+
+static void body_id_index_rebuild(body_id_index_t *idx, int capacity) {
+	free(idx->slots);
+	body_id_index_init(idx, capacity);
+	int i;
+	for(i=0; i<app_data.num_bodies; i++) {
+		body_id_index_insert(idx, app_data.bodies[i]->id, i);
+	}
+}
+
+/* The lowest unused id can only grow as bodies are added, so remember
+ * where the last search stopped instead of starting over at 1. */
 static int body_auto_id(void) 
 {
-	int i;
-	int id;
-	for(id=1; ; id++) {
-		bool used = false;
-		for(i=0; i<app_data.num_bodies; i++) {
-			if(app_data.bodies[i]->id == id) {
-				used = true;
-				break;
-			}
+	while(lookup_body_by_id(app_data.next_auto_id) != NULL) {
+		app_data.next_auto_id++;
+	}
+	return app_data.next_auto_id;
+}
+
+/* Make sure there is room for one more body (and its state slot).  This
+ * must be called before body_init(), which writes to the new state slot. */
+static void reserve_body_slot(void) {
+	if(app_data.num_bodies < app_data.bodies_capacity) {
+		return;
+	}
+	int capacity = app_data.bodies_capacity;
+	app_data.bodies = array_grow(app_data.bodies, &capacity, sizeof(app_data.bodies[0]), "bodies");
+	capacity = app_data.bodies_capacity;
+	app_data.body_links = 
+		array_grow(app_data.body_links, &capacity, sizeof(app_data.body_links[0]), "body_links");
+	app_data.bodies_capacity = capacity;
+	scene_state_reserve(&app_data.scene, capacity);
+}
+
+/* Bounding box of a body's shape in its own shape frame. */
+static void body_local_bbox(body_t *body, bbox_t *bb) {
+	switch(body->type) {
+	case BODY_TYPE_BALL: {
+		double r = ((ball_t *)body)->radius;
+		bb->x_min = -r;
+		bb->y_min = -r;
+		bb->x_max = r;
+		bb->y_max = r;
+		break;
+	}
+	case BODY_TYPE_BLOCK: {
+		block_t *block = (block_t *)body;
+		bb->x_min = -block->width/2.0;
+		bb->y_min = -block->height/2.0;
+		bb->x_max = block->width/2.0;
+		bb->y_max = block->height/2.0;
+		break;
+	}
+	case BODY_TYPE_POLYGON: {
+		polygon_t *poly = (polygon_t *)body;
+		int i;
+		bb->x_min = bb->y_min = bb->x_max = bb->y_max = 0.0;
+		for(i=0; i<poly->node_count; i++) {
+			if(i == 0 || poly->node_x[i] < bb->x_min) bb->x_min = poly->node_x[i];
+			if(i == 0 || poly->node_y[i] < bb->y_min) bb->y_min = poly->node_y[i];
+			if(i == 0 || poly->node_x[i] > bb->x_max) bb->x_max = poly->node_x[i];
+			if(i == 0 || poly->node_y[i] > bb->y_max) bb->y_max = poly->node_y[i];
+		}
+		break;
+	}
+	default:
+		bb->x_min = bb->y_min = bb->x_max = bb->y_max = 0.0;
+	}
+}
+
+/* Axis-aligned bounds of a box after transforming it. */
+static void bbox_transform(const bbox_t *in, const transform_t *t, bbox_t *out) {
+	double cx = (in->x_min + in->x_max) / 2.0;
+	double cy = (in->y_min + in->y_max) / 2.0;
+	double ex = (in->x_max - in->x_min) / 2.0;
+	double ey = (in->y_max - in->y_min) / 2.0;
+	double x = t->x_offset + t->A[0][0] * cx + t->A[0][1] * cy;
+	double y = t->y_offset + t->A[1][0] * cx + t->A[1][1] * cy;
+	double hx = fabs(t->A[0][0]) * ex + fabs(t->A[0][1]) * ey;
+	double hy = fabs(t->A[1][0]) * ex + fabs(t->A[1][1]) * ey;
+	out->x_min = x - hx;
+	out->x_max = x + hx;
+	out->y_min = y - hy;
+	out->y_max = y + hy;
+}
+
+/* The text drawn next to a body or connector ("name", "id" or
+ * "name (id)"), or NULL if it has none. */
+static char *make_label(const char *name, int id, bool show_name, bool show_id) {
+	if(!show_name && !show_id) {
+		return NULL;
+	}
+	if(name == NULL) {
+		name = "";
+	}
+	char *label = malloc(strlen(name) + 16);
+	if(label == NULL) {
+		ERROR("Error allocating label\n");
+		exit(-1);
+	}
+	if(show_name && show_id) {
+		sprintf(label, "%s (%d)", name, id);
+	} else if(show_name) {
+		strcpy(label, name);
+	} else {
+		sprintf(label, "%d", id);
+	}
+	return label;
+}
+
+static void add_body(body_t *body) {
+	assert(body->index == app_data.num_bodies);
+	app_data.bodies[app_data.num_bodies++] = body;
+	app_data.scene.num_bodies = app_data.num_bodies;
+
+	/* Parents are looked up while the child is parsed, so they always have
+	 * a lower index.  update_body_transforms() relies on this. */
+	body_link_t *link = &app_data.body_links[body->index];
+	link->xy_parent = body->xy_parent ? body->xy_parent->index : -1;
+	link->theta_parent = body->theta_parent ? body->theta_parent->index : -1;
+	assert(link->xy_parent < body->index && link->theta_parent < body->index);
+	transform_make(&link->shape_to_body, body->x_offset, body->y_offset, body->phi);
+	body_local_bbox(body, &link->local_bbox);
+	body->label = make_label(body->name, body->id, body->show_name, body->show_id);
+	if(body->trail_length > 0) {
+		if(app_data.num_trails >= app_data.trails_capacity) {
+			app_data.trail_bodies = array_grow(app_data.trail_bodies, &app_data.trails_capacity, 
+				sizeof(app_data.trail_bodies[0]), "trails");
 		}
-		if(!used) {
-			return id;
+		app_data.trail_bodies[app_data.num_trails++] = body->index;
+		if(body->trail_length > app_data.max_trail_length) {
+			app_data.max_trail_length = body->trail_length;
 		}
 	}
+	if(body->line_width > app_data.max_line_width) {
+		app_data.max_line_width = body->line_width;
+	}
+
+	// keep the id index at most half full
+	body_id_index_t *idx = &app_data.body_ids;
+	if(2 * (idx->count + 1) > idx->capacity) {
+		body_id_index_rebuild(idx, 2 * idx->capacity);
+	}
+	else {
+		body_id_index_insert(idx, body->id, body->index);
+	}
+}
+
+static void add_connector(connector_t *connect) {
+	if(app_data.num_connectors >= app_data.connectors_capacity) {
+		app_data.connectors = array_grow(app_data.connectors, &app_data.connectors_capacity, 
+			sizeof(app_data.connectors[0]), "connectors");
+	}
+	app_data.connectors[app_data.num_connectors++] = connect;
+	connect->label = make_label(connect->name, connect->id, connect->show_name, connect->show_id);
+	if(connect->thickness > app_data.max_line_width) {
+		app_data.max_line_width = connect->thickness;
+	}
+}
+
+static void add_ground(ground_t *ground) {
+	if(app_data.num_grounds >= app_data.grounds_capacity) {
+		app_data.grounds = array_grow(app_data.grounds, &app_data.grounds_capacity, 
+			sizeof(app_data.grounds[0]), "grounds");
+	}
+	app_data.grounds[app_data.num_grounds++] = ground;
+}
+
+static void add_input_map(input_map_t *map) {
+	if(app_data.num_input_maps >= app_data.input_maps_capacity) {
+		app_data.input_maps = array_grow(app_data.input_maps, &app_data.input_maps_capacity, 
+			sizeof(app_data.input_maps[0]), "input_maps");
+	}
+	app_data.input_maps[app_data.num_input_maps++] = map;
 }
 
 int polygon_set_nodes(polygon_t *self, int node_count, double *x, double *y, bool copy) {
+	polygon_lod_clear(self);
 	if(self->node_owner) {
 		if(self->node_x != NULL) {
 			free(self->node_x);
@@ -531,6 +1173,131 @@ int polygon_set_nodes(polygon_t *self, int node_count, double *x, double *y, boo
 	return 0;
 }
 
+// polygons with fewer nodes than this are always drawn as they are
+#define LOD_MIN_NODES 64
+// how far (in pixels) a simplified outline may stray from the real one
+#define LOD_TOLERANCE_PX 0.5
+
+static double segment_dist2(double px, double py, double ax, double ay, double bx, double by) {
+	double dx = bx - ax;
+	double dy = by - ay;
+	double len2 = dx * dx + dy * dy;
+	double t = 0.0;
+	if(len2 > 0.0) {
+		t = ((px - ax) * dx + (py - ay) * dy) / len2;
+		t = (t < 0.0) ? 0.0 : (t > 1.0) ? 1.0 : t;
+	}
+	double ex = ax + t * dx - px;
+	double ey = ay + t * dy - py;
+	return ex * ex + ey * ey;
+}
+
+/* Douglas-Peucker: mark the nodes between first and last (exclusive) that
+ * are needed to stay within tol of the original. */
+static void douglas_peucker(double *x, double *y, int first, int last, double tol, char *keep, int *stack) {
+	int top = 0;
+	stack[top++] = first;
+	stack[top++] = last;
+	while(top > 0) {
+		int b = stack[--top];
+		int a = stack[--top];
+		double max_d2 = 0.0;
+		int max_i = -1;
+		int i;
+		for(i=a+1; i<b; i++) {
+			double d2 = segment_dist2(x[i], y[i], x[a], y[a], x[b], y[b]);
+			if(d2 > max_d2) {
+				max_d2 = d2;
+				max_i = i;
+			}
+		}
+		if(max_i >= 0 && max_d2 > tol * tol) {
+			keep[max_i] = 1;
+			stack[top++] = a;
+			stack[top++] = max_i;
+			stack[top++] = max_i;
+			stack[top++] = b;
+		}
+	}
+}
+
+static void polygon_simplify(polygon_t *self, double tol, polygon_lod_t *lod) {
+	int n = self->node_count;
+	double *x = self->node_x;
+	double *y = self->node_y;
+	char *keep = calloc(n, sizeof(keep[0]));
+	int *stack = malloc(2 * n * sizeof(stack[0]));
+	lod->node_x = malloc(n * sizeof(lod->node_x[0]));
+	lod->node_y = malloc(n * sizeof(lod->node_y[0]));
+	if(keep == NULL || stack == NULL || lod->node_x == NULL || lod->node_y == NULL) {
+		ERROR("Error allocating polygon level of detail\n");
+		exit(-1);
+	}
+
+	/* The outline is closed, so split it at the node farthest from the
+	 * first one; that keeps at least a triangle. */
+	int i, far = 0;
+	double far_d2 = -1.0;
+	for(i=1; i<n; i++) {
+		double d2 = (x[i] - x[0]) * (x[i] - x[0]) + (y[i] - y[0]) * (y[i] - y[0]);
+		if(d2 > far_d2) {
+			far_d2 = d2;
+			far = i;
+		}
+	}
+	keep[0] = keep[far] = keep[n-1] = 1;
+	douglas_peucker(x, y, 0, far, tol, keep, stack);
+	douglas_peucker(x, y, far, n-1, tol, keep, stack);
+
+	lod->node_count = 0;
+	for(i=0; i<n; i++) {
+		if(keep[i]) {
+			lod->node_x[lod->node_count] = x[i];
+			lod->node_y[lod->node_count] = y[i];
+			lod->node_count++;
+		}
+	}
+	free(keep);
+	free(stack);
+}
+
+/* The nodes to draw a polygon with at the given scale (pixels per user
+ * unit).  Simplified node sets are cached per power-of-two scale band. */
+static void polygon_lod_nodes(polygon_t *self, double scale, int *count, double **x, double **y) {
+	*count = self->node_count;
+	*x = self->node_x;
+	*y = self->node_y;
+	if(self->node_count < LOD_MIN_NODES || !(scale > 0.0)) {
+		return;
+	}
+
+	int band = (int)floor(log2(scale));
+	int i;
+	polygon_lod_t *lod = NULL;
+	for(i=0; i<self->num_lod; i++) {
+		if(self->lod[i].band == band) {
+			lod = &self->lod[i];
+			break;
+		}
+	}
+	if(lod == NULL) {
+		if(self->num_lod < POLYGON_LOD_SLOTS) {
+			lod = &self->lod[self->num_lod++];
+		} else {
+			lod = &self->lod[self->lod_next];
+			self->lod_next = (self->lod_next + 1) % POLYGON_LOD_SLOTS;
+			free(lod->node_x);
+			free(lod->node_y);
+		}
+		lod->band = band;
+		// the scale is below 2^(band+1), so this tolerance is at most LOD_TOLERANCE_PX on screen
+		polygon_simplify(self, LOD_TOLERANCE_PX / ldexp(1.0, band + 1), lod);
+	}
+	*count = lod->node_count;
+	*x = lod->node_x;
+	*y = lod->node_y;
+}
+
 
 int body_set_name(body_t *self, char *name) {
 	if(self->name != NULL) {
@@ -833,7 +1600,7 @@ int parse_attrib_to_string(xmlNode *xml, char **dest, char *attrib_name, bool re
 			return -1;
 		}
 		else {
-			char *s = malloc(strlen(dflt));
+			char *s = malloc(strlen(dflt) + 1);
 			if(s == NULL) {
 				fprintf(stderr, "Error allocating string memory!\n");
 				exit(-1);
@@ -954,26 +1721,12 @@ int parse_attrib_to_bool(xmlNode *xml, bool *dest, char *attrib_name, bool requi
 	return 0;
 }
 
-body_t *lookup_body_by_id(int id) {
-	int i;
-	for(i=0; i < app_data.num_bodies; i++) {
-		if(app_data.bodies[i]->id == id) {
-			return app_data.bodies[i];
-		}
-	}
-	return NULL;
-}
-
 int parse_input_format_xml(xmlNode *xml) {
 		
 	xmlNode *xnode;
 	for(xnode = xml->children; xnode != NULL; xnode = xnode->next) {
 		if(xnode->type == XML_ELEMENT_NODE && !strcmp(xnode->name, "map") ) {
 			DEBUG("  Got <map> element\n");
-			if(app_data.num_input_maps >= MAX_INPUT_MAPS) {
-				ERROR("Too many input format entries!!\n");
-				exit(-1);
-			}
 
 			int err = 0;
 			int column;
@@ -987,9 +1740,11 @@ int parse_input_format_xml(xmlNode *xml) {
 			}
 			input_map_t *map = malloc(sizeof(input_map_t));
 			map->field_num = column;
+			map->frame_byte_offset = app_data.bytes_per_frame;
+			map->plot = false;
 			switch(type) {
 				case INPUT_TYPE_TIME:
-					map->dest = &app_data.time;
+					map->dest_index = -1;
 					map->data_type = DATA_TYPE_DOUBLE;
 					app_data.bytes_per_frame += sizeof(double);
 					if(app_data.explicit_time) {
@@ -1019,17 +1774,20 @@ int parse_input_format_xml(xmlNode *xml) {
 						return -1;
 					}
 					if(!strcmp(field_str, "x")) {
-						map->dest = &body->x;
+						map->dest_index = 
+							body->index * BODY_STATE_SLOTS + offsetof(body_state_t, x) / sizeof(double);
 						map->data_type = DATA_TYPE_DOUBLE;
 						app_data.bytes_per_frame += sizeof(double);
 					}
 					else if(!strcmp(field_str, "y")) {
-						map->dest = &body->y;
+						map->dest_index = 
+							body->index * BODY_STATE_SLOTS + offsetof(body_state_t, y) / sizeof(double);
 						map->data_type = DATA_TYPE_DOUBLE;
 						app_data.bytes_per_frame += sizeof(double);
 					}
 					else if(!strcmp(field_str, "theta")) {
-						map->dest = &body->theta;
+						map->dest_index = 
+							body->index * BODY_STATE_SLOTS + offsetof(body_state_t, theta) / sizeof(double);
 						map->data_type = DATA_TYPE_DOUBLE;
 						app_data.bytes_per_frame += sizeof(double);
 					}
@@ -1039,10 +1797,15 @@ int parse_input_format_xml(xmlNode *xml) {
 						free(map);
 						return -1;
 					}
+					xmlFree(field_str);
+					if(parse_attrib_to_bool(xnode, &map->plot, "plot", false, true)) {
+						free(map);
+						return -1;
+					}
 					break;
 				}
 			}
-			app_data.input_maps[app_data.num_input_maps++] = map;
+			add_input_map(map);
 		}
 	}
 	return 0;
@@ -1072,6 +1835,13 @@ int parse_connector_xml(xmlNode *xml, connector_t *connect) {
 	error = error || parse_attrib_to_int(xml, &connect->id, "id", true, 0);
 	error = error || parse_attrib_to_color(xml, &(connect->color), "color", false, &COLOR_BLACK);
 	error = error || parse_attrib_to_double(xml, &connect->thickness, "line_width", false, 2.0);
+	error = error || parse_attrib_to_bool(xml, &connect->show_name, "show_name", false, false);
+	error = error || parse_attrib_to_bool(xml, &connect->show_id, "show_id", false, false);
+	if(!error) {
+		char name[24];
+		sprintf(name, "connector_%03d", connect->id);
+		error = parse_attrib_to_string(xml, &connect->name, "name", false, name);
+	}
 
 	if(error) {
 		ERROR("Error parsing <connector> XML\n");
@@ -1160,9 +1930,16 @@ int parse_body_xml(xmlNode *xml, body_t *body) {
 	error = error || parse_attrib_to_bool(xml, &body->show_name, "show_name", false, false);
 	error = error || parse_attrib_to_bool(xml, &body->show_id, "show_id", false, false);
 	error = error || parse_attrib_to_bool(xml, &body->filled, "filled", false, true);
-	error = error || parse_attrib_to_double(xml, &(body->x), "x", false , 0.);
-	error = error || parse_attrib_to_double(xml, &(body->y), "y", false , 0.);
-	error = error || parse_attrib_to_double(xml, &(body->theta), "theta", false , 0.);
+	error = error || parse_attrib_to_int(xml, &body->trail_length, "trail", false, 0);
+	error = error || parse_attrib_to_double(xml, &body->trail_x, "trail_x", false, 0.);
+	error = error || parse_attrib_to_double(xml, &body->trail_y, "trail_y", false, 0.);
+	if(body->trail_length < 0) {
+		body->trail_length = 0;
+	}
+	body_state_t *state = BODY_STATE(body);
+	error = error || parse_attrib_to_double(xml, &(state->x), "x", false , 0.);
+	error = error || parse_attrib_to_double(xml, &(state->y), "y", false , 0.);
+	error = error || parse_attrib_to_double(xml, &(state->theta), "theta", false , 0.);
 	error = error || parse_attrib_to_double(xml, &(body->x_offset), "x_offset", false , 0.);
 	error = error || parse_attrib_to_double(xml, &(body->y_offset), "y_offset", false , 0.);
 	error = error || parse_attrib_to_double(xml, &(body->theta_offset), "theta_offset", false , 0.);
@@ -1254,24 +2031,6 @@ int parse_polygon_xml(xmlNode *xml, polygon_t *polygon) {
 	return 0;
 }
 
-#define DIE_IF_TOO_MANY_BODIES() \
-	if(app_data.num_bodies >= MAX_BODIES) { \
-		ERROR("Maximum number of bodies (%d) exceeded!\n", MAX_BODIES); \
-		exit(-1); \
-	}
-
-#define DIE_IF_TOO_MANY_CONNECTORS() \
-	if(app_data.num_connectors >= MAX_CONNECTORS) { \
-		ERROR("Maximum number of connectors (%d) exceeded!\n", MAX_CONNECTORS); \
-		exit(-1); \
-	}
-
-#define DIE_IF_TOO_MANY_GROUNDS() \
-	if(app_data.num_grounds >= MAX_GROUNDS) { \
-		ERROR("Maximum number of grounds (%d) exceeded!\n", MAX_GROUNDS); \
-		exit(-1); \
-	}
-
 int parse_root_attribs(xmlNode *xml) {
 	int error = 0;
 	error = error || parse_attrib_to_double(xml, &(app_data.x_range.min), "x_min", false, -10.0);
@@ -1298,7 +2057,7 @@ int parse_config_xml(xmlNode *xml) {
 			continue;
 		}
 		if(!strcmp(curNode->name, "ball")) {
-			DIE_IF_TOO_MANY_BODIES();
+			reserve_body_slot();
 			DEBUG("Got <ball> element!\n");
 			ball_t *ball = ball_alloc();
 			ball_init(ball);
@@ -1307,10 +2066,10 @@ int parse_config_xml(xmlNode *xml) {
 				ball_dealloc(ball);
 				continue;
 			}
-			app_data.bodies[app_data.num_bodies++] = (body_t *)ball;
+			add_body((body_t *)ball);
 		}
 		else if(!strcmp(curNode->name, "block")) {
-			DIE_IF_TOO_MANY_BODIES();
+			reserve_body_slot();
 			DEBUG("Got <block> element!\n");
 			block_t *block = block_alloc();
 			block_init(block);
@@ -1319,10 +2078,10 @@ int parse_config_xml(xmlNode *xml) {
 				block_dealloc(block);
 				continue;
 			}
-			app_data.bodies[app_data.num_bodies++] = (body_t *)block;
+			add_body((body_t *)block);
 		}
 		else if(!strcmp(curNode->name, "polygon")) {
-			DIE_IF_TOO_MANY_BODIES();
+			reserve_body_slot();
 			DEBUG("Got <polygon> element!\n");
 			polygon_t *poly = polygon_alloc();
 			polygon_init(poly);
@@ -1331,10 +2090,9 @@ int parse_config_xml(xmlNode *xml) {
 				polygon_dealloc(poly);
 				continue;
 			}
-			app_data.bodies[app_data.num_bodies++] = (body_t *)poly;
+			add_body((body_t *)poly);
 		}
 		else if(!strcmp(curNode->name, "connector")) {
-			DIE_IF_TOO_MANY_CONNECTORS();
 			DEBUG("Got <connector> element!\n");
 			connector_t *connect = connector_alloc();
 			connector_init(connect);
@@ -1343,10 +2101,9 @@ int parse_config_xml(xmlNode *xml) {
 				connector_dealloc(connect);
 				continue;
 			}
-			app_data.connectors[app_data.num_connectors++] = connect;
+			add_connector(connect);
 		}
 		else if(!strcmp(curNode->name, "ground")) {
-			DIE_IF_TOO_MANY_GROUNDS();
 			DEBUG("Got <ground> element!\n");
 			ground_t *ground = ground_alloc();
 			ground_init(ground);
@@ -1355,7 +2112,7 @@ int parse_config_xml(xmlNode *xml) {
 				ground_dealloc(ground);
 				continue;
 			}
-			app_data.grounds[app_data.num_grounds++] = ground;
+			add_ground(ground);
 		}
 		else if(!strcmp(curNode->name, "input_format")) {
 			DEBUG("Got <input_format> element!\n");
@@ -1411,6 +2168,85 @@ int split_line_into_fields(char *line, char *fields[], int max_fields) {
 	return field_count;
 }
 
+/* Parse the line just read and append it as a frame. */
+static void data_reader_parse_line(data_reader_t *r) {
+	int i;
+	int field_count = split_line_into_fields(r->line, r->fields, r->max_fields);
+	if(field_count < 0) {
+		return;
+	}
+
+	frame_ptr_t pframe = frame_alloc(app_data.bytes_per_frame);
+	for(i=0; i < app_data.num_input_maps; i++) {
+		input_map_t *map = app_data.input_maps[i];
+		if(map->field_num > field_count) {
+			ERROR("Not enough fields!!\n");
+			exit(-1);
+		}
+		int field_index = map->field_num - 1;
+		switch(map->data_type) {
+			case DATA_TYPE_DOUBLE: {
+				double d;
+				if(parse_double(r->fields[field_index], &d)) {
+					ERROR("Error parsing double from field (\"%s\")\n", r->fields[field_index]);
+					ERROR("line: %s\n", r->line);
+					exit(-1);
+				}
+				//printf("input_map #%d: column=%d, type=double, value=%g\n", i+1, map->field_num, d);
+				*((double *)(&pframe[map->frame_byte_offset])) = d;
+
+				// ensure that timestamp is monotonic, and keep track of min/max timestamps
+				if(i == app_data.time_map_index) {
+					if(app_data.num_frames == 0) { // first frame
+						app_data.t_min = d;
+						app_data.t_max = d;
+					}
+					else if(d < app_data.t_max) {
+						ERROR("Non-monotonic timestamp detected!!!\n");
+						exit(-1);
+					}
+					else {
+						app_data.t_max = d;
+					}
+				}
+				break;
+			}
+			default:
+				ERROR("Unknown data type!\n");
+		}
+	}
+	if(app_data.num_frames >= app_data.frames_capacity) {
+		pthread_rwlock_wrlock(&app_data.frames_lock);
+		app_data.frames_capacity *= 3;
+		app_data.frames = realloc(app_data.frames, app_data.frames_capacity * sizeof(app_data.frames[0]));
+		if(app_data.frames == NULL) {
+			ERROR("Error expanding size of 'frames'.\n");
+			exit(-1);
+		}
+		pthread_rwlock_unlock(&app_data.frames_lock);
+	}
+	app_data.frames[app_data.num_frames++] = pframe;
+}
+
+/* Read lines up to the end of the file.  When following, an unfinished
+ * last line is put back to be read once the rest of it is written. */
+static void data_reader_read(data_reader_t *r) {
+	ssize_t len;
+	while((len = getline(&r->line, &r->line_capacity, r->fp)) != -1) {
+		if(r->follow && r->line[len - 1] != '\n') {
+			fseek(r->fp, -len, SEEK_CUR);
+			break;
+		}
+		r->line_num++;
+		data_reader_parse_line(r);
+	}
+	if(ferror(r->fp)) {
+		ERROR("Error while reading datafile!!\n");
+		exit(-1);
+	}
+	clearerr(r->fp); // so a followed file can be read past its old end
+}
+
 void print_connector_info(connector_t *connect) {
 	printf("Connector id %-4d: Attach_1=(%d, %g, %g) Attach_2=(%d, %g, %g) \n", 
 		connect->id, 
@@ -1421,208 +2257,542 @@ void print_connector_info(connector_t *connect) {
 
 void print_body_info(body_t *body) {
 	printf("Body id %-4d: (%6g,%6g,%6g)\n", 
-		body->id, body->x, body->y, body->theta);
+		body->id, BODY_STATE(body)->x, BODY_STATE(body)->y, BODY_STATE(body)->theta);
 }
 
 
 
-static double body_theta_to_ground(body_t *body) {
-	body_t *b;
-	double theta = body->theta;
-	for(b=body; b->theta_parent != NULL; b=b->theta_parent) {
-		theta += b->theta_parent->theta;
+#define X_USER_TO_PX(x) (v->x_m * (x) + v->x_b)
+#define Y_USER_TO_PX(y) (v->y_m * (y) + v->y_b)
+#define L_USER_TO_PX(l) fabs(v->x_m * (l))
+#define L_PX_TO_USER(l) fabs((l) / v->x_m)
+#define FRAME_SIZE_PX (20)
+
+static void view_make(view_t *v, float width, float height, range_t x_range, range_t y_range) {
+	float xmin = x_range.min;
+	float xmax = x_range.max;
+	float ymin = y_range.min;
+	float ymax = y_range.max;
+
+	v->width = width;
+	v->height = height;
+	v->x_range = x_range;
+	v->y_range = y_range;
+
+	v->x_m = width/(xmax-xmin);
+	v->y_m = height/(ymin-ymax);
+	if(fabs(v->x_m) < fabs(v->y_m)) {
+		v->y_m = -v->x_m;
+		v->x_b = -v->x_m * xmin;
+		v->y_b = height/2.0 - v->y_m * (ymin+ymax)/2.0;
+	}
+	else {
+		v->x_m = -v->y_m;
+		v->y_b = -v->y_m * ymax;
+		v->x_b = width/2.0 - v->x_m * (xmin+xmax)/2.0;
 	}
-	return theta;
+	v->lod_scale = fabs(v->x_m);
 }
 
+/* The part of the user coordinate plane that is visible in the view,
+ * grown by margin_px pixels on every side. */
+static void view_visible_rect(const view_t *v, float margin_px, bbox_t *r) {
+	double x1 = (-margin_px - v->x_b) / v->x_m;
+	double x2 = (v->width + margin_px - v->x_b) / v->x_m;
+	double y1 = (-margin_px - v->y_b) / v->y_m;
+	double y2 = (v->height + margin_px - v->y_b) / v->y_m;
+	r->x_min = fmin(x1, x2);
+	r->x_max = fmax(x1, x2);
+	r->y_min = fmin(y1, y2);
+	r->y_max = fmax(y1, y2);
+}
 
-static void body_transform_shape_to_ground(body_t *body, transform_t *t_out) {
-	transform_t T;
+static void segment_bbox(double x1, double y1, double x2, double y2, double pad, bbox_t *bb) {
+	bb->x_min = fmin(x1, x2) - pad;
+	bb->x_max = fmax(x1, x2) + pad;
+	bb->y_min = fmin(y1, y2) - pad;
+	bb->y_max = fmax(y1, y2) + pad;
+}
 
-	// first step is transform from shape frame to body frame
-	transform_make(&T, body->x_offset, body->y_offset, body->phi);
+// bodies smaller than this (in pixels) are drawn as a point
+#define SUBPIXEL_PX 1.0
 
-	body_t *b;
-	for(b=body; b != NULL; b = b->xy_parent) {
-		double qpar_theta = 0.0;
-		if(b->theta_parent != NULL) {
-			qpar_theta = body_theta_to_ground(b->theta_parent);
-		}
-		double xypar_theta = 0.0;
-		if(b->xy_parent != NULL) {
-			xypar_theta = body_theta_to_ground(b->xy_parent);
-		}
-		transform_t t_new;
-		transform_make(&t_new, b->x, b->y, b->theta + qpar_theta - xypar_theta);
-		transform_append(&T, &t_new);
-	}
+// how far outside the view something may be drawn: frame indicators, ground hashes and stroke widths
+#define CULL_MARGIN_PX (FRAME_SIZE_PX + app_data.max_line_width)
+
+// body and connector labels
+#define LABEL_FONT_SIZE 10
+#define LABEL_OFFSET_PX 4
+// at DRAW_QUALITY_FAST polygons are simplified as if drawn this much
+// smaller, and springs shorter than this (in pixels) are drawn as lines
+#define FAST_LOD_SCALE 0.25
+#define FAST_SPRING_MIN_PX 30
 
-	*t_out = T;
+static bool view_equal(const view_t *a, const view_t *b) {
+	return a->width == b->width && a->height == b->height &&
+		a->x_range.min == b->x_range.min && a->x_range.max == b->x_range.max &&
+		a->y_range.min == b->y_range.min && a->y_range.max == b->y_range.max;
 }
 
-#define X_USER_TO_PX(x) (x_m * (x) + x_b)
-#define Y_USER_TO_PX(y) (y_m * (y) + y_b)
-#define L_USER_TO_PX(l) fabs(x_m * (l))
-#define L_PX_TO_USER(l) fabs((l) / x_m)
-#define FRAME_SIZE_PX (20)
-
-gboolean draw_canvas(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
-	draw_ptr dp = app_data.gui.drawer;
-	draw_start(dp); 
+/* Record everything that doesn't move: the background, the ground
+ * coordinate system and the grounds.  This only needs to be redone when
+ * the view changes. */
+static void render_static(dlist_t *dl, const view_t *v, render_stats_t *stats) {
 	int i;
-
-	float width, height;
-	draw_get_canvas_dims(dp, &width, &height);
+	bbox_t visible;
+	view_visible_rect(v, 0, &visible);
+	float xmin = visible.x_min;
+	float xmax = visible.x_max;
+	float ymin = visible.y_min;
+	float ymax = visible.y_max;
 
 	// first, fill with background color
-	draw_set_color(dp, 1,1,1);
-	draw_set_line_width(dp, 1);
-	draw_rectangle_filled(dp, 0, 0, width, height);
-
-	float xmin = app_data.x_range.min;
-	float xmax = app_data.x_range.max;
-	float ymin = app_data.y_range.min;
-	float ymax = app_data.y_range.max;
-
-	/* These are used to convert from user coordinates to pixel coordinates
-	*  Specifically: 
-	*    x_px = x_m * x_user + x_b
-	*    y_px = y_m * y_user + y_b
-	*/
-	float x_m, x_b;
-	float y_m, y_b;
-	x_m = width/(xmax-xmin);
-	y_m = height/(ymin-ymax);
-	if(fabs(x_m) < fabs(y_m)) {
-		y_m = -x_m;
-		x_b = -x_m * xmin;
-		y_b = height/2.0 - y_m * (ymin+ymax)/2.0;
-	}
-	else {
-		x_m = -y_m;
-		y_b = -y_m * ymax;
-		x_b = width/2.0 - x_m * (xmin+xmax)/2.0;
-	}
-	
+	dl_set_color(dl, 1,1,1);
+	dl_set_line_width(dl, 1);
+	dl_rectangle_filled(dl, 0, 0, v->width, v->height);
+
 	// now draw the ground coordinate system ***************************
-	draw_set_color(dp, 0.5,0.5,0.5);
-	draw_line(dp, X_USER_TO_PX(0), Y_USER_TO_PX(ymin), X_USER_TO_PX(0), Y_USER_TO_PX(ymax));
-	draw_line(dp, X_USER_TO_PX(xmin), Y_USER_TO_PX(0), X_USER_TO_PX(xmax), Y_USER_TO_PX(0));
+	dl_set_color(dl, 0.5,0.5,0.5);
+	dl_line(dl, X_USER_TO_PX(0), Y_USER_TO_PX(ymin), X_USER_TO_PX(0), Y_USER_TO_PX(ymax));
+	dl_line(dl, X_USER_TO_PX(xmin), Y_USER_TO_PX(0), X_USER_TO_PX(xmax), Y_USER_TO_PX(0));
 
-	//draw_set_color(dp, 0, 0, 0);	
-	//draw_text(dp, "hello world", 10, X_USER_TO_PX(0), Y_USER_TO_PX(0), ANCHOR_MIDDLE_MIDDLE);
+	//dl_set_color(dl, 0, 0, 0);	
+	//dl_text(dl, "hello world", 10, X_USER_TO_PX(0), Y_USER_TO_PX(0), ANCHOR_MIDDLE_MIDDLE);
 
-	// draw all bodies *************************************************
-	for(i=0; i < app_data.num_bodies; i++) {
-		body_t *body = app_data.bodies[i];
-		switch(body->type) {
-		case BODY_TYPE_BALL: {
-			draw_set_color(dp, body->color.red, body->color.green, body->color.blue);
-			float r = ((ball_t *)body)->radius;
-			double x_c, y_c;
-			transform_point(&(body->trans_shape_to_gnd), 0.0, 0.0, &x_c, &y_c);
-
-			if(body->filled) 
-				draw_circle_filled(dp, X_USER_TO_PX(x_c), Y_USER_TO_PX(y_c), L_USER_TO_PX(r));
-			else {
-				draw_set_line_width(dp, body->line_width);
-				draw_circle_outline(dp, X_USER_TO_PX(x_c), Y_USER_TO_PX(y_c), L_USER_TO_PX(r));
-			}
+	// draw all the grounds ************************************************
+	view_visible_rect(v, CULL_MARGIN_PX, &visible);
+	stats->grounds_drawn = 0;
+	stats->grounds_culled = 0;
+	for(i=0; i < app_data.num_grounds; i++) {
+		ground_t *gnd = app_data.grounds[i];
+		bbox_t bb;
+		segment_bbox(gnd->x1, gnd->y1, gnd->x2, gnd->y2, 0.0, &bb);
+		if(!bbox_overlap(&bb, &visible)) {
+			stats->grounds_culled++;
+			continue;
+		}
+		stats->grounds_drawn++;
+		switch(gnd->type) {
+		case GND_TYPE_LINE: {
+			dl_set_color(dl, 0,0,0);
+			dl_set_line_width(dl, 2.0);
+			dl_line ( dl,
+				X_USER_TO_PX(gnd->x1), Y_USER_TO_PX(gnd->y1),
+				X_USER_TO_PX(gnd->x2), Y_USER_TO_PX(gnd->y2)
+			);
 			break;
 		}
-		case BODY_TYPE_BLOCK: {
-			block_t *block = (block_t *)body;
-			draw_set_color(dp, body->color.red, body->color.green, body->color.blue);
-			float w_2 = block->width/2.0;
-			float h_2 = block->height/2.0;
-			double x[4] = {-w_2, +w_2, +w_2, -w_2};
-			double y[4] = {-h_2, -h_2, +h_2, +h_2};
-			transform_points(&(body->trans_shape_to_gnd), 4, x, y, x, y);
+		case GND_TYPE_HASH: {
+			dl_set_color(dl, 0,0,0);
+			dl_set_line_width(dl, 2.0);
+			float x1_px = X_USER_TO_PX(gnd->x1);
+			float y1_px = Y_USER_TO_PX(gnd->y1);
+			float x2_px = X_USER_TO_PX(gnd->x2);
+			float y2_px = Y_USER_TO_PX(gnd->y2);
+			dl_line(dl, x1_px, y1_px, x2_px, y2_px);
+			float dx = x2_px-x1_px;
+			float dy = y2_px-y1_px;
+			float theta = atan2(dy,dx);
+			float L = sqrt(dx * dx + dy * dy);
+			int num_hashes = L / 10;
+			float hash_len = 10;
+			float hash_rads = 0.7;
+			float sin_ = sin(theta + hash_rads);
+			float cos_ = cos(theta + hash_rads);
 			int i;
-			float x_px[4], y_px[4];
-			for(i=0; i<4; i++) {
-				x_px[i] = X_USER_TO_PX(x[i]);
-				y_px[i] = Y_USER_TO_PX(y[i]);
-			}
-			if(body->filled) 
-				draw_polygon_filled(dp, x_px, y_px, 4);
-			else {
-				draw_set_line_width(dp, body->line_width);
-				draw_polygon_outline(dp, x_px, y_px, 4);
+			for(i=0; i < num_hashes; i++) {
+				float fract = (float)i/num_hashes;
+				dl_line ( dl,
+					x1_px + fract*dx, y1_px + fract*dy,
+					x1_px + fract*dx + hash_len*cos_, 
+					y1_px + fract*dy + hash_len*sin_
+				);
 			}
 			break;
 		}
-		case BODY_TYPE_POLYGON: {
-			polygon_t *poly = (polygon_t *)body;
-			draw_set_color(dp, body->color.red, body->color.green, body->color.blue);
-			float *x = malloc(poly->node_count * sizeof(float));
-			float *y = malloc(poly->node_count * sizeof(float));
-			assert(x && y);
+		default:
+			//ERROR("Unsupported ground type!\n");
+			//exit(-1);
+			;
+		}
+	}
+}
 
-			int i;
-			for(i=0; i<poly->node_count; i++) {
-				double tmp_x, tmp_y;
-				transform_point(&(body->trans_shape_to_gnd), poly->node_x[i], poly->node_y[i], &tmp_x, &tmp_y);
-				x[i] = tmp_x;
-				y[i] = tmp_y;
-				x[i] = X_USER_TO_PX(x[i]);
-				y[i] = Y_USER_TO_PX(y[i]);
-			}
-			if(body->filled) 
-				draw_polygon_filled(dp, x, y, poly->node_count);
-			else {
-				draw_set_line_width(dp, body->line_width);
-				draw_polygon_outline(dp, x, y, poly->node_count);
-			}
+/* Record a body's shape, placed by T (its shape frame to ground). */
+static void render_body_shape(dlist_t *dl, body_t *body, transform_t *T, const view_t *v, int quality, 
+	render_stats_t *stats) {
+	switch(body->type) {
+	case BODY_TYPE_BALL: {
+		dl_set_color(dl, body->color.red, body->color.green, body->color.blue);
+		float r = ((ball_t *)body)->radius;
+		double x_c, y_c;
+		transform_point(T, 0.0, 0.0, &x_c, &y_c);
+
+		if(body->filled) 
+			dl_circle_filled(dl, X_USER_TO_PX(x_c), Y_USER_TO_PX(y_c), L_USER_TO_PX(r));
+		else {
+			dl_set_line_width(dl, body->line_width);
+			dl_circle_outline(dl, X_USER_TO_PX(x_c), Y_USER_TO_PX(y_c), L_USER_TO_PX(r));
+		}
+		break;
+	}
+	case BODY_TYPE_BLOCK: {
+		block_t *block = (block_t *)body;
+		dl_set_color(dl, body->color.red, body->color.green, body->color.blue);
+		float w_2 = block->width/2.0;
+		float h_2 = block->height/2.0;
+		double x[4] = {-w_2, +w_2, +w_2, -w_2};
+		double y[4] = {-h_2, -h_2, +h_2, +h_2};
+		transform_points(T, 4, x, y, x, y);
+		int i;
+		float x_px[4], y_px[4];
+		for(i=0; i<4; i++) {
+			x_px[i] = X_USER_TO_PX(x[i]);
+			y_px[i] = Y_USER_TO_PX(y[i]);
+		}
+		if(body->filled) 
+			dl_polygon_filled(dl, x_px, y_px, 4);
+		else {
+			dl_set_line_width(dl, body->line_width);
+			dl_polygon_outline(dl, x_px, y_px, 4);
+		}
+		break;
+	}
+	case BODY_TYPE_POLYGON: {
+		polygon_t *poly = (polygon_t *)body;
+		dl_set_color(dl, body->color.red, body->color.green, body->color.blue);
+		if(!body->filled) {
+			dl_set_line_width(dl, body->line_width);
+		}
+		int node_count;
+		double *node_x, *node_y;
+		double lod_scale = (quality == DRAW_QUALITY_FAST) ? FAST_LOD_SCALE * v->lod_scale : v->lod_scale;
+		polygon_lod_nodes(poly, lod_scale, &node_count, &node_x, &node_y);
+		stats->polygon_nodes_skipped += poly->node_count - node_count;
 
-			free(x);
-			free(y);
-			break;
+		float *x = dl_polygon_points(dl, node_count, body->filled);
+		float *y = x + node_count;
+
+		int i;
+		for(i=0; i<node_count; i++) {
+			double tmp_x, tmp_y;
+			transform_point(T, node_x[i], node_y[i], &tmp_x, &tmp_y);
+			x[i] = tmp_x;
+			y[i] = tmp_y;
+			x[i] = X_USER_TO_PX(x[i]);
+			y[i] = Y_USER_TO_PX(y[i]);
 		}
-		default:
-			ERROR("Unsupported body type!\n");
+		break;
+	}
+	default:
+		ERROR("Unsupported body type!\n");
+		exit(-1);
+	}
+}
+
+/* Sprite cache **********************************************************/
+
+#define SPRITE_UNKNOWN -1
+#define SPRITE_NONE -2
+
+static void sprite_cache_init(sprite_cache_t *sc) {
+	memset(sc, 0, sizeof(sprite_cache_t));
+	dl_init(&sc->dl);
+}
+
+static void sprite_cache_reset(sprite_cache_t *sc) {
+	int i;
+	for(i=0; i < sc->num_sprites; i++) {
+		draw_sprite_destroy(sc->dp, sc->sprites[i].sprite);
+	}
+	sc->num_sprites = 0;
+	if(sc->body_sprite) {
+		for(i=0; i < app_data.num_bodies; i++) {
+			sc->body_sprite[i] = SPRITE_UNKNOWN;
+		}
+	}
+}
+
+static void sprite_cache_free(sprite_cache_t *sc) {
+	sprite_cache_reset(sc);
+	free(sc->body_sprite);
+	dl_destroy(&sc->dl);
+}
+
+/* Get ready to draw a frame with view v.  Returns false if there are no
+ * sprites to be had. */
+static bool sprite_cache_begin(sprite_cache_t *sc, const view_t *v) {
+	if(sc == NULL || sc->unsupported) {
+		return false;
+	}
+	if(sc->body_sprite == NULL) {
+		sc->body_sprite = malloc((app_data.num_bodies + 1) * sizeof(int));
+		if(sc->body_sprite == NULL) {
+			ERROR("Error allocating sprite cache\n");
+			exit(-1);
+		}
+		sc->scale = 0; // forces the reset below
+	}
+	if(sc->scale != v->x_m) {
+		sprite_cache_reset(sc);
+		sc->scale = v->x_m;
+	}
+	return true;
+}
+
+static bool shape_equal(const body_t *a, const body_t *b) {
+	if(a->type != b->type || a->filled != b->filled || (!a->filled && a->line_width != b->line_width)) {
+		return false;
+	}
+	switch(a->type) {
+	case BODY_TYPE_BALL:
+		return ((ball_t *)a)->radius == ((ball_t *)b)->radius;
+	case BODY_TYPE_BLOCK:
+		return ((block_t *)a)->width == ((block_t *)b)->width && 
+			((block_t *)a)->height == ((block_t *)b)->height;
+	case BODY_TYPE_POLYGON: {
+		const polygon_t *p = (const polygon_t *)a;
+		const polygon_t *q = (const polygon_t *)b;
+		size_t n = p->node_count * sizeof(double);
+		return p->node_count == q->node_count && 
+			!memcmp(p->node_x, q->node_x, n) && !memcmp(p->node_y, q->node_y, n);
+	}
+	default:
+		return false;
+	}
+}
+
+// how far the shape reaches from its origin, in user units
+static double shape_extent(const body_t *body) {
+	int i;
+	double r = 0.0;
+	switch(body->type) {
+	case BODY_TYPE_BALL:
+		r = ((ball_t *)body)->radius;
+		break;
+	case BODY_TYPE_BLOCK:
+		r = hypot(((block_t *)body)->width, ((block_t *)body)->height) / 2.0;
+		break;
+	case BODY_TYPE_POLYGON: {
+		const polygon_t *p = (const polygon_t *)body;
+		for(i=0; i < p->node_count; i++) {
+			r = fmax(r, hypot(p->node_x[i], p->node_y[i]));
+		}
+		break;
+	}
+	}
+	return r;
+}
+
+/* Draw body's shape, unrotated and centered on its origin, into a new
+ * sprite. */
+static sprite_t *sprite_make(sprite_cache_t *sc, body_t *body, const view_t *v, int size) {
+	draw_sprite_ptr sp = draw_sprite_create(sc->dp, size, size);
+	if(sp == NULL) {
+		sc->unsupported = true;
+		return NULL;
+	}
+
+	view_t sv = *v;
+	sv.width = size;
+	sv.height = size;
+	sv.x_b = size / 2.0;
+	sv.y_b = size / 2.0;
+	transform_t T;
+	transform_make(&T, 0.0, 0.0, 0.0);
+	dl_clear(&sc->dl);
+	render_body_shape(&sc->dl, body, &T, &sv, DRAW_QUALITY_BEST, &sc->stats);
+
+	draw_set_quality(sc->dp, DRAW_QUALITY_BEST);
+	draw_sprite_begin(sc->dp, sp);
+	dl_replay(&sc->dl, sc->dp);
+	draw_sprite_end(sc->dp);
+
+	sprite_t *sprite = &sc->sprites[sc->num_sprites++];
+	sprite->sprite = sp;
+	sprite->shape = body;
+	sprite->size = size;
+	return sprite;
+}
+
+static sprite_t *sprite_for_body(sprite_cache_t *sc, body_t *body, const view_t *v) {
+	int i;
+	int *slot = &sc->body_sprite[body->index];
+	if(*slot == SPRITE_UNKNOWN) {
+		*slot = SPRITE_NONE;
+		double r = L_USER_TO_PX(shape_extent(body)) + (body->filled ? 0.0 : body->line_width / 2.0) + 2.0;
+		int size = 2 * (int)ceil(r);
+		if(size > SPRITE_MAX_PX) {
+			return NULL;
+		}
+		for(i=0; i < sc->num_sprites; i++) {
+			if(shape_equal(sc->sprites[i].shape, body)) {
+				*slot = i;
+				break;
+			}
+		}
+		if(*slot == SPRITE_NONE && sc->num_sprites < MAX_SPRITES && sprite_make(sc, body, v, size)) {
+			*slot = sc->num_sprites - 1;
+		}
+	}
+	return (*slot >= 0) ? &sc->sprites[*slot] : NULL;
+}
+
+static void trails_rebuild(scene_state_t *ss);
+
+/* Evaluate the moving part of the scene for the current state and record
+ * it as draw commands.  Bodies and connectors outside the view are skipped:
+ * static bodies are looked up in the grid, moving ones (whose boxes change
+ * every frame) are tested directly, and the two are merged back into index
+ * order, so the drawing order doesn't change. */
+static void render_scene(dlist_t *dl, scene_state_t *ss, const view_t *v, int quality, 
+	sprite_cache_t *sprites, render_stats_t *stats) {
+	int i, k;
+	bbox_t visible;
+	view_visible_rect(v, CULL_MARGIN_PX, &visible);
+
+	if(app_data.num_trails > 0 && !ss->trails_valid) {
+		trails_rebuild(ss);
+	}
+	if(!ss->grid_valid) {
+		ss->static_bbox = malloc((app_data.num_static_bodies + 1) * sizeof(bbox_t));
+		ss->visible_bodies = malloc((ss->num_bodies + 1) * sizeof(int));
+		if(ss->static_bbox == NULL || ss->visible_bodies == NULL) {
+			ERROR("Error allocating culling grid\n");
 			exit(-1);
-		} // end switch(body->type)
+		}
+		for(k=0; k < app_data.num_static_bodies; k++) {
+			ss->static_bbox[k] = ss->bbox[app_data.static_bodies[k]];
+		}
+		grid_build(&ss->grid, ss->static_bbox, app_data.num_static_bodies);
+		ss->grid_valid = true;
+	}
+	int *found;
+	int num_found = grid_query(&ss->grid, ss->static_bbox, &visible, &found);
+	int *visible_bodies = ss->visible_bodies;
+	int num_visible = 0;
+	k = 0;
+	for(i=0; i < app_data.num_moving_bodies; i++) {
+		int b = app_data.moving_bodies[i];
+		if(!bbox_overlap(&ss->bbox[b], &visible)) {
+			continue;
+		}
+		while(k < num_found && app_data.static_bodies[found[k]] < b) {
+			visible_bodies[num_visible++] = app_data.static_bodies[found[k++]];
+		}
+		visible_bodies[num_visible++] = b;
+	}
+	while(k < num_found) {
+		visible_bodies[num_visible++] = app_data.static_bodies[found[k++]];
+	}
+	stats->bodies_drawn = num_visible;
+	stats->bodies_culled = ss->num_bodies - num_visible;
+	stats->bodies_subpixel = 0;
+	stats->bodies_sprite = 0;
+	stats->polygon_nodes_skipped = 0;
+	if(!sprite_cache_begin(sprites, v)) {
+		sprites = NULL;
+	}
+
+	// motion trails, underneath the bodies ****************************
+	dl_set_line_width(dl, 1.0);
+	for(i=0; i < app_data.num_trails; i++) {
+		body_t *body = app_data.bodies[app_data.trail_bodies[i]];
+		const trail_t *t = &ss->trails[i];
+		if(t->count < 2) {
+			continue;
+		}
+		// faded toward white
+		dl_set_color(dl, (1.0 + body->color.red) / 2.0, (1.0 + body->color.green) / 2.0, 
+			(1.0 + body->color.blue) / 2.0);
+		float *x = dl_polygon_points(dl, t->count, 0);
+		float *y = x + t->count;
+		for(k=0; k < t->count; k++) {
+			int slot = (t->start + k) % body->trail_length;
+			x[k] = X_USER_TO_PX(t->x[slot]);
+			y[k] = Y_USER_TO_PX(t->y[slot]);
+		}
+	}
+
+	// draw all bodies *************************************************
+	sprite_t *sprite;
+	for(k=0; k < num_visible; k++) {
+		body_t *body = app_data.bodies[visible_bodies[k]];
+		const bbox_t *bb = &ss->bbox[body->index];
+		if(L_USER_TO_PX(fmax(bb->x_max - bb->x_min, bb->y_max - bb->y_min)) < SUBPIXEL_PX) {
+			// smaller than a pixel: a dot is all that would show anyway
+			dl_set_color(dl, body->color.red, body->color.green, body->color.blue);
+			dl_point(dl, X_USER_TO_PX((bb->x_min + bb->x_max) / 2.0), Y_USER_TO_PX((bb->y_min + bb->y_max) / 2.0));
+			stats->bodies_subpixel++;
+		}
+		else if(sprites && (sprite = sprite_for_body(sprites, body, v)) != NULL) {
+			transform_t *T = BODY_TRANS(ss, body);
+			dl_set_color(dl, body->color.red, body->color.green, body->color.blue);
+			// y is flipped on screen, so the rotation is too
+			dl_sprite(dl, sprite->sprite, X_USER_TO_PX(T->x_offset), Y_USER_TO_PX(T->y_offset), 
+				-atan2(T->A[1][0], T->A[0][0]), sprite->size / 2.0 * M_SQRT2);
+			stats->bodies_sprite++;
+		}
+		else {
+			render_body_shape(dl, body, BODY_TRANS(ss, body), v, quality, stats);
+		}
 
 		if(body->show_body_frame) {
 			double x[3] = {L_PX_TO_USER(FRAME_SIZE_PX), 0, 0};
 			double y[3] = {0, 0, L_PX_TO_USER(FRAME_SIZE_PX)};
-			transform_points(&(body->trans_shape_to_gnd), 3, x, y, x, y);
+			transform_points(BODY_TRANS(ss, body), 3, x, y, x, y);
 			int i;
 			float x_px[3], y_px[3];
 			for(i=0; i<3; i++) {
 				x_px[i] = X_USER_TO_PX(x[i]);
 				y_px[i] = Y_USER_TO_PX(y[i]);
 			}
-			draw_set_color(dp, 0,0,0);
-			draw_polygon_outline(dp, x_px, y_px, 3);
+			dl_set_color(dl, 0,0,0);
+			dl_polygon_outline(dl, x_px, y_px, 3);
 		}
 		if(body->show_shape_frame) {
 			double x[3] = {L_PX_TO_USER(FRAME_SIZE_PX), 0, 0};
 			double y[3] = {0, 0, L_PX_TO_USER(FRAME_SIZE_PX)};
-			transform_points(&(body->trans_shape_to_gnd), 3, x, y, x, y);
+			transform_points(BODY_TRANS(ss, body), 3, x, y, x, y);
 			int i;
 			float x_px[3], y_px[3];
 			for(i=0; i<3; i++) {
 				x_px[i] = X_USER_TO_PX(x[i]);
 				y_px[i] = Y_USER_TO_PX(y[i]);
 			}
-			draw_set_color(dp, 0,0,0);
-			draw_polygon_outline(dp, x_px, y_px, 3);
+			dl_set_color(dl, 0,0,0);
+			dl_polygon_outline(dl, x_px, y_px, 3);
 		}
 	}
 
 	// draw all the connectors ************************************************
+	stats->connectors_drawn = 0;
+	stats->connectors_culled = 0;
 	for(i=0; i < app_data.num_connectors; i++) {
 		connector_t *connect = app_data.connectors[i];
-		switch(connect->type) {
+		double x1, y1, x2, y2;
+		transform_point(BODY_TRANS(ss, connect->body_1), connect->x1, connect->y1, &x1, &y1);
+		transform_point(BODY_TRANS(ss, connect->body_2), connect->x2, connect->y2, &x2, &y2);
+
+		// springs zig-zag up to 0.1 * length to either side
+		bbox_t bb;
+		double pad = (connect->type == CONN_TYPE_SPRING) ? 0.1 * hypot(x2 - x1, y2 - y1) : 0.0;
+		segment_bbox(x1, y1, x2, y2, pad, &bb);
+		if(!bbox_overlap(&bb, &visible)) {
+			stats->connectors_culled++;
+			continue;
+		}
+		stats->connectors_drawn++;
+
+		int type = connect->type;
+		if(type == CONN_TYPE_SPRING && quality == DRAW_QUALITY_FAST &&
+			L_USER_TO_PX(hypot(x2 - x1, y2 - y1)) < FAST_SPRING_MIN_PX) {
+			type = CONN_TYPE_LINE;
+		}
+		switch(type) {
 			case CONN_TYPE_SPRING:
-				draw_set_color(dp, connect->color.red, connect->color.green, connect->color.blue);
-				draw_set_line_width(dp, connect->thickness);
-			
-				double x1, x2, y1, y2;
-				transform_point(&(connect->body_1->trans_shape_to_gnd), connect->x1, connect->y1, &x1, &y1);
-				transform_point(&(connect->body_2->trans_shape_to_gnd), connect->x2, connect->y2, &x2, &y2);
+				dl_set_color(dl, connect->color.red, connect->color.green, connect->color.blue);
+				dl_set_line_width(dl, connect->thickness);
 
 				float dx = x2 - x1;
 				float dy = y2 - y1;
@@ -1640,15 +2810,12 @@ gboolean draw_canvas(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
 					x_px[i] = X_USER_TO_PX(x1 + x[i] * cos_ - y[i] * sin_);
 					y_px[i] = Y_USER_TO_PX(y1 + x[i] * sin_ + y[i] * cos_);
 				}
-				draw_polygon_outline(dp, x_px, y_px, 9);
+				dl_polygon_outline(dl, x_px, y_px, 9);
 				break;
 			case CONN_TYPE_LINE: {
-				draw_set_color(dp, connect->color.red, connect->color.green, connect->color.blue);
-				draw_set_line_width(dp, connect->thickness);
-				double x1, y1, x2, y2;
-				transform_point(&(connect->body_1->trans_shape_to_gnd), connect->x1, connect->y1, &x1, &y1);
-				transform_point(&(connect->body_2->trans_shape_to_gnd), connect->x2, connect->y2, &x2, &y2);
-				draw_line ( dp,
+				dl_set_color(dl, connect->color.red, connect->color.green, connect->color.blue);
+				dl_set_line_width(dl, connect->thickness);
+				dl_line ( dl,
 					X_USER_TO_PX(x1), Y_USER_TO_PX(y1),
 					X_USER_TO_PX(x2), Y_USER_TO_PX(y2)
 				);
@@ -1660,328 +2827,2539 @@ gboolean draw_canvas(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
 		}
 	}
 
-	// draw all the grounds ************************************************
-	for(i=0; i < app_data.num_grounds; i++) {
-		ground_t *gnd = app_data.grounds[i];
-		switch(gnd->type) {
-		case GND_TYPE_LINE: {
-			draw_set_color(dp, 0,0,0);
-			draw_set_line_width(dp, 2.0);
-			draw_line ( dp,
-				X_USER_TO_PX(gnd->x1), Y_USER_TO_PX(gnd->y1),
-				X_USER_TO_PX(gnd->x2), Y_USER_TO_PX(gnd->y2)
-			);
-			break;
+	// labels, on top of everything else *******************************
+	for(k=0; k < num_visible; k++) {
+		body_t *body = app_data.bodies[visible_bodies[k]];
+		if(body->label == NULL) {
+			continue;
 		}
-		case GND_TYPE_HASH: {
-			draw_set_color(dp, 0,0,0);
-			draw_set_line_width(dp, 2.0);
-			float x1_px = X_USER_TO_PX(gnd->x1);
-			float y1_px = Y_USER_TO_PX(gnd->y1);
-			float x2_px = X_USER_TO_PX(gnd->x2);
-			float y2_px = Y_USER_TO_PX(gnd->y2);
-			draw_line(dp, x1_px, y1_px, x2_px, y2_px);
-			float dx = x2_px-x1_px;
-			float dy = y2_px-y1_px;
-			float theta = atan2(dy,dx);
-			float L = sqrt(dx * dx + dy * dy);
-			int num_hashes = L / 10;
-			float hash_len = 10;
-			float hash_rads = 0.7;
-			float sin_ = sin(theta + hash_rads);
-			float cos_ = cos(theta + hash_rads);
-			int i;
-			for(i=0; i < num_hashes; i++) {
-				float fract = (float)i/num_hashes;
-				draw_line ( dp,
-					x1_px + fract*dx, y1_px + fract*dy,
-					x1_px + fract*dx + hash_len*cos_, 
-					y1_px + fract*dy + hash_len*sin_
-				);
-			}
-			break;
+		const transform_t *T = &ss->frame_to_gnd[body->index];
+		dl_set_color(dl, body->color.red, body->color.green, body->color.blue);
+		dl_text(dl, body->label, LABEL_FONT_SIZE, 
+			X_USER_TO_PX(T->x_offset) + LABEL_OFFSET_PX, Y_USER_TO_PX(T->y_offset) - LABEL_OFFSET_PX, 
+			ANCHOR_BOTTOM_LEFT);
+	}
+	for(i=0; i < app_data.num_connectors; i++) {
+		connector_t *connect = app_data.connectors[i];
+		if(connect->label == NULL) {
+			continue;
 		}
-		default:
-			//ERROR("Unsupported ground type!\n");
-			//exit(-1);
-			;
+		double x1, y1, x2, y2;
+		transform_point(BODY_TRANS(ss, connect->body_1), connect->x1, connect->y1, &x1, &y1);
+		transform_point(BODY_TRANS(ss, connect->body_2), connect->x2, connect->y2, &x2, &y2);
+		double x_mid = (x1 + x2) / 2.0;
+		double y_mid = (y1 + y2) / 2.0;
+		if(x_mid < visible.x_min || x_mid > visible.x_max || y_mid < visible.y_min || y_mid > visible.y_max) {
+			continue;
 		}
+		dl_set_color(dl, connect->color.red, connect->color.green, connect->color.blue);
+		dl_text(dl, connect->label, LABEL_FONT_SIZE, 
+			X_USER_TO_PX(x_mid) + LABEL_OFFSET_PX, Y_USER_TO_PX(y_mid) - LABEL_OFFSET_PX, 
+			ANCHOR_BOTTOM_LEFT);
 	}
+}
 
-	draw_finish(dp); 
-	return TRUE;
+// size of the area render_overlay() draws into
+#define OVERLAY_WIDTH_PX 400
+#define OVERLAY_HEIGHT_PX 88
+
+/* Record the render statistics in the top left corner. */
+static void render_overlay(dlist_t *dl, const render_stats_t *stats) {
+	char str[64];
+	dl_set_color(dl, 0, 0, 0);
+	snprintf(str, sizeof(str), "bodies: %d drawn, %d culled", stats->bodies_drawn, stats->bodies_culled);
+	dl_text(dl, str, 10, 5, 5, ANCHOR_TOP_LEFT);
+	snprintf(str, sizeof(str), "connectors: %d drawn, %d culled", 
+		stats->connectors_drawn, stats->connectors_culled);
+	dl_text(dl, str, 10, 5, 18, ANCHOR_TOP_LEFT);
+	snprintf(str, sizeof(str), "grounds: %d drawn, %d culled", stats->grounds_drawn, stats->grounds_culled);
+	dl_text(dl, str, 10, 5, 31, ANCHOR_TOP_LEFT);
+	snprintf(str, sizeof(str), "lod: %d sub-pixel bodies, %d sprites, %d polygon nodes skipped", 
+		stats->bodies_subpixel, stats->bodies_sprite, stats->polygon_nodes_skipped);
+	dl_text(dl, str, 10, 5, 44, ANCHOR_TOP_LEFT);
+	snprintf(str, sizeof(str), "seek: %.1f ms latency, %d dropped", 
+		stats->seek_latency_ms, stats->seeks_dropped);
+	dl_text(dl, str, 10, 5, 57, ANCHOR_TOP_LEFT);
+	snprintf(str, sizeof(str), "frame: %.1f ms, %s quality", 
+		stats->frame_ms, (stats->quality == DRAW_QUALITY_FAST) ? "fast" : "best");
+	dl_text(dl, str, 10, 5, 70, ANCHOR_TOP_LEFT);
+}
+
+/* Damage tracking *****************************************************
+ *
+ * Instead of repainting the whole canvas every frame, the pixel bounds of
+ * each body, connector and the trails are kept from the last frame.
+ * Whatever moved damages both its old and new bounds, and only those
+ * areas are invalidated and redrawn (with drawing clipped to them). */
+
+static void damage_clear(damage_t *d) {
+	d->count = 0;
+	d->all = false;
+}
+
+static void bbox_union(bbox_t *a, const bbox_t *b) {
+	a->x_min = fmin(a->x_min, b->x_min);
+	a->y_min = fmin(a->y_min, b->y_min);
+	a->x_max = fmax(a->x_max, b->x_max);
+	a->y_max = fmax(a->y_max, b->y_max);
+}
+
+static double bbox_area(const bbox_t *b) {
+	return (b->x_max - b->x_min) * (b->y_max - b->y_min);
 }
 
-static void update_body_transforms(void) {
+static void damage_add(damage_t *d, const bbox_t *b) {
 	int i;
-	for(i=0; i<app_data.num_bodies; i++) {
-		body_transform_shape_to_ground(app_data.bodies[i], &(app_data.bodies[i]->trans_shape_to_gnd));
+	if(d->all || b->x_min > b->x_max) {
+		return;
+	}
+	for(i=0; i < d->count; i++) {
+		if(bbox_overlap(&d->rects[i], b)) {
+			bbox_union(&d->rects[i], b);
+			return;
+		}
 	}
+	if(d->count < MAX_DAMAGE_RECTS) {
+		d->rects[d->count++] = *b;
+		return;
+	}
+	// out of rectangles: grow the one that grows least
+	int best = 0;
+	double best_growth = INFINITY;
+	for(i=0; i < d->count; i++) {
+		bbox_t u = d->rects[i];
+		bbox_union(&u, b);
+		double growth = bbox_area(&u) - bbox_area(&d->rects[i]);
+		if(growth < best_growth) {
+			best_growth = growth;
+			best = i;
+		}
+	}
+	bbox_union(&d->rects[best], b);
 }
 
-static void update_bodies(void) {
-	int j;
-	frame_ptr_t pframe = app_data.frames[app_data.active_frame_index];
+static void damage_merge(damage_t *dst, const damage_t *src) {
+	int i;
+	if(src->all) {
+		dst->all = true;
+		return;
+	}
+	for(i=0; i < src->count; i++) {
+		damage_add(dst, &src->rects[i]);
+	}
+}
 
-	/* loop over all input maps, stuffing the data
-	 * in the frame into the proper destination location */
-	for(j=0; j < app_data.num_input_maps; j++) {
-		input_map_t *map = app_data.input_maps[j];
-		switch(map->data_type) {
-			case DATA_TYPE_DOUBLE:
-				*((double *)(map->dest)) = *((double *)(&pframe[map->frame_byte_offset]));
-				break;
-			default:
-				ERROR("Unhandled data type!!!\n");
-				exit(-1);
+static void bbox_to_px(const view_t *v, const bbox_t *in, double pad, bbox_t *out) {
+	double xa = X_USER_TO_PX(in->x_min);
+	double xb = X_USER_TO_PX(in->x_max);
+	double ya = Y_USER_TO_PX(in->y_min);
+	double yb = Y_USER_TO_PX(in->y_max);
+	out->x_min = fmin(xa, xb) - pad;
+	out->x_max = fmax(xa, xb) + pad;
+	out->y_min = fmin(ya, yb) - pad;
+	out->y_max = fmax(ya, yb) + pad;
+}
+
+// generous bounds of a label drawn at (x,y) by render_scene()
+static void label_px_bbox(const char *label, double x, double y, bbox_t *out) {
+	out->x_min = x;
+	out->x_max = x + LABEL_OFFSET_PX + strlen(label) * LABEL_FONT_SIZE;
+	out->y_min = y - LABEL_OFFSET_PX - 2 * LABEL_FONT_SIZE;
+	out->y_max = y;
+}
+
+static void damage_update(damage_t *damage, bool all, bbox_t *old, const bbox_t *b) {
+	if(!all && memcmp(old, b, sizeof(bbox_t))) {
+		damage_add(damage, old);
+		damage_add(damage, b);
+	}
+	*old = *b;
+}
+
+/* Add what changed on screen since the last frame tracked by t (for the
+ * same scene state) to damage. */
+static void damage_track(damage_tracker_t *t, scene_state_t *ss, const view_t *v, bool overlay, int quality, 
+	damage_t *damage) {
+	int i, k;
+	if(t->body_px == NULL) {
+		t->body_px = malloc((app_data.num_bodies + 1) * sizeof(bbox_t));
+		t->connector_px = malloc((app_data.num_connectors + 1) * sizeof(bbox_t));
+		if(t->body_px == NULL || t->connector_px == NULL) {
+			ERROR("Error allocating damage tracker\n");
+			exit(-1);
+		}
+	}
+	if(app_data.num_trails > 0 && !ss->trails_valid) {
+		trails_rebuild(ss);
+	}
+	bool all = !t->valid || !view_equal(&t->view, v) || overlay != t->overlay || quality != t->quality;
+	if(all) {
+		damage->all = true;
+	}
+
+	bbox_t b, lb;
+	for(i=0; i < ss->num_bodies; i++) {
+		body_t *body = app_data.bodies[i];
+		bbox_to_px(v, &ss->bbox[i], CULL_MARGIN_PX + 1, &b);
+		if(body->label) {
+			const transform_t *T = &ss->frame_to_gnd[i];
+			label_px_bbox(body->label, X_USER_TO_PX(T->x_offset), Y_USER_TO_PX(T->y_offset), &lb);
+			bbox_union(&b, &lb);
+		}
+		if(body->show_body_frame || body->show_shape_frame) {
+			// the frame indicator is drawn at the shape origin, which can be outside the shape
+			const transform_t *T = BODY_TRANS(ss, body);
+			double x = X_USER_TO_PX(T->x_offset), y = Y_USER_TO_PX(T->y_offset);
+			bbox_t fb = {x - FRAME_SIZE_PX - 2, y - FRAME_SIZE_PX - 2, x + FRAME_SIZE_PX + 2, y + FRAME_SIZE_PX + 2};
+			bbox_union(&b, &fb);
+		}
+		damage_update(damage, all, &t->body_px[i], &b);
+	}
+
+	for(i=0; i < app_data.num_connectors; i++) {
+		connector_t *connect = app_data.connectors[i];
+		double x1, y1, x2, y2;
+		transform_point(BODY_TRANS(ss, connect->body_1), connect->x1, connect->y1, &x1, &y1);
+		transform_point(BODY_TRANS(ss, connect->body_2), connect->x2, connect->y2, &x2, &y2);
+		double pad = (connect->type == CONN_TYPE_SPRING) ? 0.1 * hypot(x2 - x1, y2 - y1) : 0.0;
+		bbox_t wb;
+		segment_bbox(x1, y1, x2, y2, pad, &wb);
+		bbox_to_px(v, &wb, connect->thickness / 2.0 + 1, &b);
+		if(connect->label) {
+			label_px_bbox(connect->label, X_USER_TO_PX((x1 + x2) / 2.0), Y_USER_TO_PX((y1 + y2) / 2.0), &lb);
+			bbox_union(&b, &lb);
+		}
+		damage_update(damage, all, &t->connector_px[i], &b);
+	}
+
+	// empty (x_min > x_max) if there are no trails
+	b.x_min = b.y_min = INFINITY;
+	b.x_max = b.y_max = -INFINITY;
+	for(i=0; i < app_data.num_trails; i++) {
+		body_t *body = app_data.bodies[app_data.trail_bodies[i]];
+		const trail_t *tr = &ss->trails[i];
+		for(k=0; k < tr->count; k++) {
+			int slot = (tr->start + k) % body->trail_length;
+			double x = X_USER_TO_PX(tr->x[slot]);
+			double y = Y_USER_TO_PX(tr->y[slot]);
+			b.x_min = fmin(b.x_min, x - 2);
+			b.x_max = fmax(b.x_max, x + 2);
+			b.y_min = fmin(b.y_min, y - 2);
+			b.y_max = fmax(b.y_max, y + 2);
 		}
 	}
+	damage_update(damage, all, &t->trails_px, &b);
 
-	update_body_transforms();
+	if(overlay) {
+		// the numbers change every frame
+		bbox_t ob = {0, 0, OVERLAY_WIDTH_PX, OVERLAY_HEIGHT_PX};
+		damage_add(damage, &ob);
+	}
 
+	t->valid = true;
+	t->view = *v;
+	t->overlay = overlay;
+	t->quality = quality;
 }
 
-static double get_time_from_frame(frame_ptr_t pframe) {
-	assert(app_data.explicit_time);
-	input_map_t *map = app_data.input_maps[app_data.time_map_index];
-	double t = *((double *)(&pframe[map->frame_byte_offset]));
-	return t;
+static void damage_tracker_free(damage_tracker_t *t) {
+	free(t->body_px);
+	free(t->connector_px);
+	memset(t, 0, sizeof(*t));
+}
+
+/* Invalidate the damaged parts of the canvas. */
+static void damage_queue(const damage_t *d) {
+	GtkWidget *canvas = app_data.gui.canvas;
+	int i;
+	if(d->all) {
+		gtk_widget_queue_draw(canvas);
+		return;
+	}
+	double w = canvas->allocation.width;
+	double h = canvas->allocation.height;
+	for(i=0; i < d->count; i++) {
+		const bbox_t *b = &d->rects[i];
+		int x0 = (int)floor(fmax(b->x_min, -1));
+		int y0 = (int)floor(fmax(b->y_min, -1));
+		int x1 = (int)ceil(fmin(b->x_max, w + 1));
+		int y1 = (int)ceil(fmin(b->y_max, h + 1));
+		if(x1 > x0 && y1 > y0) {
+			gtk_widget_queue_draw_area(canvas, x0, y0, x1 - x0, y1 - y0);
+		}
+	}
+}
+
+/* Tile cache ************************************************************
+ *
+ * Tiles sit on a grid in "global" pixels (x_m * x, y_m * y), which only
+ * depends on the zoom, so panning just moves the grid and reuses them.  A
+ * new zoom gets a new set of tiles; old ones are dropped least recently
+ * used first.  Layers from the cairo and soft backends can be blitted by
+ * any drawer, so the render thread keeps its tiles across its buffers. */
+
+static void tile_cache_init(tile_cache_t *tc) {
+	memset(tc, 0, sizeof(tile_cache_t));
+	dl_init(&tc->dl);
+}
+
+static void tile_cache_free(tile_cache_t *tc, draw_ptr dp) {
+	int i;
+	for(i=0; i < MAX_TILES; i++) {
+		draw_layer_destroy(dp, tc->tiles[i].layer);
+	}
+	dl_destroy(&tc->dl);
+}
+
+/* Split a view offset into the whole pixel the tile grid is blitted at
+ * and the fraction left over, which the tiles are drawn with. */
+static float tile_origin(float b, float *frac) {
+	float o = floor(b + 0.5);
+	*frac = b - o;
+	return o;
+}
+
+/* The tiles covering the view.  Returns the number of them. */
+static int tile_range(const view_t *v, int *tx0, int *ty0, int *tx1, int *ty1) {
+	float fx, fy;
+	float ox = tile_origin(v->x_b, &fx);
+	float oy = tile_origin(v->y_b, &fy);
+	*tx0 = (int)floor(-ox / TILE_PX);
+	*ty0 = (int)floor(-oy / TILE_PX);
+	*tx1 = (int)ceil((v->width - ox) / TILE_PX) - 1;
+	*ty1 = (int)ceil((v->height - oy) / TILE_PX) - 1;
+	return (*tx1 - *tx0 + 1) * (*ty1 - *ty0 + 1);
+}
+
+// offsets closer than this are the same tile; x_b is only a float
+#define TILE_FRAC_EPS (1.0/64)
+
+static tile_t *tile_find(tile_cache_t *tc, const view_t *v, int tx, int ty) {
+	int i;
+	float fx, fy;
+	tile_origin(v->x_b, &fx);
+	tile_origin(v->y_b, &fy);
+	for(i=0; i < MAX_TILES; i++) {
+		tile_t *t = &tc->tiles[i];
+		if(t->layer && t->tx == tx && t->ty == ty && fabs(t->scale - v->x_m) <= 1e-6 * fabs(v->x_m)
+			&& fabs(t->fx - fx) <= TILE_FRAC_EPS && fabs(t->fy - fy) <= TILE_FRAC_EPS) {
+			t->last_used = tc->frame;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Draw a new tile, reusing the least recently used slot.  Returns NULL if
+ * the backend has no layers. */
+static tile_t *tile_render(tile_cache_t *tc, draw_ptr dp, const view_t *v, int tx, int ty) {
+	int i;
+	tile_t *t = NULL;
+	for(i=0; i < MAX_TILES; i++) {
+		tile_t *c = &tc->tiles[i];
+		if(c->layer == NULL) {
+			t = c;
+			break;
+		}
+		if(c->last_used != tc->frame && (t == NULL || c->last_used < t->last_used)) {
+			t = c;
+		}
+	}
+	assert(t != NULL); // a view never needs more than MAX_TILES
+	if(t->layer == NULL) {
+		t->layer = draw_layer_create(dp, TILE_PX, TILE_PX);
+		if(t->layer == NULL) {
+			return NULL;
+		}
+	}
+
+	float fx, fy;
+	tile_origin(v->x_b, &fx);
+	tile_origin(v->y_b, &fy);
+	view_t tv;
+	tv.width = TILE_PX;
+	tv.height = TILE_PX;
+	tv.x_m = v->x_m;
+	tv.y_m = v->y_m;
+	tv.x_b = fx - tx * TILE_PX;
+	tv.y_b = fy - ty * TILE_PX;
+	tv.x_range.min = -tv.x_b / tv.x_m;
+	tv.x_range.max = (TILE_PX - tv.x_b) / tv.x_m;
+	tv.y_range.min = (TILE_PX - tv.y_b) / tv.y_m;
+	tv.y_range.max = -tv.y_b / tv.y_m;
+	tv.lod_scale = v->lod_scale;
+
+	dl_clear(&tc->dl);
+	render_static(&tc->dl, &tv, &tc->stats);
+	dl_sort_by_state(&tc->dl);
+	draw_set_quality(dp, DRAW_QUALITY_BEST);
+	draw_layer_begin(dp, t->layer);
+	dl_replay(&tc->dl, dp);
+	draw_layer_end(dp);
+
+	t->scale = v->x_m;
+	t->fx = fx;
+	t->fy = fy;
+	t->tx = tx;
+	t->ty = ty;
+	t->last_used = tc->frame;
+	return t;
+}
+
+/* Draw up to max_new of the tiles the view is missing.  Returns how many
+ * are still missing, or -1 if the view can't be tiled. */
+static int tile_cache_fill(tile_cache_t *tc, draw_ptr dp, const view_t *v, int max_new) {
+	int tx, ty, tx0, ty0, tx1, ty1;
+	if(tile_range(v, &tx0, &ty0, &tx1, &ty1) > MAX_TILES) {
+		return -1;
+	}
+	tc->frame++;
+	int missing = 0;
+	for(ty=ty0; ty <= ty1; ty++) {
+		for(tx=tx0; tx <= tx1; tx++) {
+			if(tile_find(tc, v, tx, ty) == NULL) {
+				missing++;
+			}
+		}
+	}
+	for(ty=ty0; ty <= ty1 && missing > 0 && max_new > 0; ty++) {
+		for(tx=tx0; tx <= tx1 && missing > 0 && max_new > 0; tx++) {
+			if(tile_find(tc, v, tx, ty) == NULL) {
+				if(tile_render(tc, dp, v, tx, ty) == NULL) {
+					return -1;
+				}
+				missing--;
+				max_new--;
+			}
+		}
+	}
+	return missing;
+}
+
+/* Draw the static content from tiles, first drawing up to max_new missing
+ * ones.  Returns -1 (having drawn nothing useful) if tiles are still
+ * missing, so the caller has to draw it directly. */
+static int tile_cache_draw(tile_cache_t *tc, draw_ptr dp, const view_t *v, int max_new) {
+	int tx, ty, tx0, ty0, tx1, ty1;
+	if(tile_cache_fill(tc, dp, v, max_new) != 0) {
+		return -1;
+	}
+	tile_range(v, &tx0, &ty0, &tx1, &ty1);
+	float fx, fy;
+	float ox = tile_origin(v->x_b, &fx);
+	float oy = tile_origin(v->y_b, &fy);
+	for(ty=ty0; ty <= ty1; ty++) {
+		for(tx=tx0; tx <= tx1; tx++) {
+			tile_t *t = tile_find(tc, v, tx, ty);
+			// whole pixels, so the tiles aren't resampled; the fraction is in the tile
+			draw_layer_blit(dp, t->layer, tx * TILE_PX + ox, ty * TILE_PX + oy);
+		}
+	}
+	return 0;
+}
+
+// tiles drawn per idle callback, to keep the main loop responsive
+#define TILES_PER_IDLE 4
+
+static void current_view(view_t *v) {
+	GtkWidget *canvas = app_data.gui.canvas;
+	view_make(v, canvas->allocation.width, canvas->allocation.height, app_data.x_range, app_data.y_range);
+}
+
+static gboolean tiles_idle_cb(gpointer data) {
+	gui_t *gp = &app_data.gui;
+	draw_ptr dp = gp->drawer;
+	view_t view;
+	current_view(&view);
+	draw_start(dp);
+	draw_clip(dp, 0, 0, 0, 0); // only the tiles are drawn
+	int missing = tile_cache_fill(&gp->tiles, dp, &view, TILES_PER_IDLE);
+	draw_finish(dp);
+	if(missing > 0) {
+		return TRUE;
+	}
+	gp->tiles_idle = 0;
+	return FALSE;
+}
+
+/* Draw the static part of the scene, from the tile cache when it covers
+ * the view.  Otherwise it's drawn directly and the missing tiles are
+ * drawn later, when the main loop is idle. */
+static void draw_background(gui_t *gp, draw_ptr dp, const view_t *view) {
+	if(tile_cache_draw(&gp->tiles, dp, view, 0) == 0) {
+		gp->stats.grounds_drawn = 0;
+		gp->stats.grounds_culled = 0;
+		return;
+	}
+
+	if(!gp->bg_valid || !view_equal(&gp->bg_view, view)) {
+		dl_clear(&gp->bg_dlist);
+		render_static(&gp->bg_dlist, view, &gp->stats);
+		dl_sort_by_state(&gp->bg_dlist);
+		gp->bg_view = *view;
+		gp->bg_valid = true;
+	}
+	dl_replay(&gp->bg_dlist, dp);
+
+	if(gp->tiles_idle == 0) {
+		gp->tiles_idle = g_idle_add_full(G_PRIORITY_LOW, tiles_idle_cb, NULL, NULL);
+	}
+}
+
+static void render_thread_resize(render_thread_t *rt, int width, int height);
+static void render_thread_show(render_thread_t *rt, draw_ptr dp);
+static void render_thread_refresh(render_thread_t *rt);
+
+/* Render quality ********************************************************
+ *
+ * While playing or seeking, a frame that takes longer than the budget to
+ * draw at best quality is drawn fast instead (see draw_set_quality() and
+ * FAST_LOD_SCALE).  Once the frame has stopped changing for a while it
+ * is drawn again at best quality. */
+
+// a little under the playback interval, leaving time for the main loop
+#define QUALITY_BUDGET_MS 20.0
+#define QUALITY_SETTLE_MS 250
+
+/* Queue a redraw of whatever changed since the last frame shown. */
+static void queue_scene_redraw(void) {
+	gui_t *gp = &app_data.gui;
+	if(gp->render_thread) {
+		render_thread_refresh(gp->render_thread);
+		return;
+	}
+	view_t view;
+	current_view(&view);
+	damage_t damage;
+	damage_clear(&damage);
+	damage_track(&gp->damage, &app_data.scene, &view, gp->show_overlay, gp->quality, &damage);
+	damage_queue(&damage);
+}
+
+static void quality_frame_drawn(int quality, double ms) {
+	gui_t *gp = &app_data.gui;
+	gp->stats.frame_ms = ms;
+	gp->stats.quality = quality;
+	if(quality == DRAW_QUALITY_BEST) {
+		gp->best_frame_ms = (gp->best_frame_ms > 0) ? 0.8 * gp->best_frame_ms + 0.2 * ms : ms;
+	}
+}
+
+static gboolean quality_settle_cb(gpointer data) {
+	gui_t *gp = &app_data.gui;
+	if(g_get_monotonic_time() - gp->last_motion < QUALITY_SETTLE_MS * 1000) {
+		return TRUE;
+	}
+	gp->quality_timeout = 0;
+	gp->quality = DRAW_QUALITY_BEST;
+	queue_scene_redraw();
+	return FALSE;
+}
+
+/* The frame is about to change from playback or a seek. */
+static void quality_motion(void) {
+	gui_t *gp = &app_data.gui;
+	gp->last_motion = g_get_monotonic_time();
+	if(gp->best_frame_ms > QUALITY_BUDGET_MS) {
+		gp->quality = DRAW_QUALITY_FAST;
+	}
+	if(gp->quality == DRAW_QUALITY_FAST && gp->quality_timeout == 0) {
+		gp->quality_timeout = g_timeout_add(QUALITY_SETTLE_MS / 2, quality_settle_cb, NULL);
+	}
+}
+
+gboolean draw_canvas(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
+	gui_t *gp = &app_data.gui;
+	draw_ptr dp = gp->drawer;
+	scene_state_t *ss = &app_data.scene;
+	draw_start(dp); 
+
+	float width, height;
+	draw_get_canvas_dims(dp, &width, &height);
+	draw_clip(dp, event->area.x, event->area.y, event->area.width, event->area.height);
+
+	/* With a render thread, the frame is already drawn; just copy it. */
+	if(gp->render_thread) {
+		render_thread_resize(gp->render_thread, width, height);
+		render_thread_show(gp->render_thread, dp);
+		draw_finish(dp);
+		return TRUE;
+	}
+
+	gint64 start = g_get_monotonic_time();
+	view_t view;
+	view_make(&view, width, height, app_data.x_range, app_data.y_range);
+
+	draw_set_quality(dp, DRAW_QUALITY_BEST);
+	draw_background(gp, dp, &view);
+
+	/* Only re-evaluate the scene if something changed since the display
+	 * list was recorded; a plain re-expose just replays it. */
+	bool recorded = false;
+	if(!gp->dlist_valid || gp->dlist_generation != ss->generation ||
+		!view_equal(&gp->dlist_view, &view) || gp->dlist_quality != gp->quality) {
+		dl_clear(&gp->dlist);
+		gp->sprites.dp = dp;
+		render_scene(&gp->dlist, ss, &view, gp->quality, &gp->sprites, &gp->stats);
+		dl_sort_by_state(&gp->dlist);
+		if(gp->show_overlay) {
+			render_overlay(&gp->dlist, &gp->stats);
+		}
+		gp->dlist_valid = true;
+		gp->dlist_generation = ss->generation;
+		gp->dlist_view = view;
+		gp->dlist_quality = gp->quality;
+		recorded = true;
+	}
+	draw_set_quality(dp, gp->dlist_quality);
+	dl_replay(&gp->dlist, dp);
+
+	draw_finish(dp); 
+
+	// only count frames that were evaluated, not plain re-exposes
+	if(recorded) {
+		quality_frame_drawn(gp->dlist_quality, (g_get_monotonic_time() - start) / 1000.0);
+	}
+
+	if(gp->seek_start && gp->seek_idle == 0) {
+		gp->stats.seek_latency_ms = (g_get_monotonic_time() - gp->seek_start) / 1000.0;
+		gp->seek_start = 0;
+	}
+	return TRUE;
+}
+
+/* Compute body i's transforms, from its parents' (already computed) ones. */
+static inline void update_body_transform(scene_state_t *ss, int i) {
+	const body_link_t *link = &app_data.body_links[i];
+	const body_state_t *state = &ss->body_state[i];
+
+	double qpar_theta = 0.0;
+	if(link->theta_parent >= 0) {
+		qpar_theta = ss->theta_to_gnd[link->theta_parent];
+	}
+	ss->theta_to_gnd[i] = state->theta + qpar_theta;
+
+	double xypar_theta = 0.0;
+	if(link->xy_parent >= 0) {
+		xypar_theta = ss->theta_to_gnd[link->xy_parent];
+	}
+
+	transform_t T;
+	transform_make(&T, state->x, state->y, state->theta + qpar_theta - xypar_theta);
+	if(link->xy_parent >= 0) {
+		transform_append(&T, &ss->frame_to_gnd[link->xy_parent]);
+	}
+	ss->frame_to_gnd[i] = T;
+
+	transform_t S = link->shape_to_body;
+	transform_append(&S, &T);
+	ss->shape_to_gnd[i] = S;
+	bbox_transform(&link->local_bbox, &S, &ss->bbox[i]);
+}
+
+/* Compute every body's transforms in a single pass over the hot arrays.
+ * Since parents always precede their children, each body can build on its
+ * parents' already-computed ground transforms. */
+static void update_body_transforms(scene_state_t *ss) {
+	int i;
+	for(i=0; i<ss->num_bodies; i++) {
+		update_body_transform(ss, i);
+	}
+	ss->generation++;
+}
+
+static double get_time_from_frame(frame_ptr_t pframe) {
+	assert(app_data.explicit_time);
+	input_map_t *map = app_data.input_maps[app_data.time_map_index];
+	double t = *((double *)(&pframe[map->frame_byte_offset]));
+	return t;
+}
+
+/* Time of a frame, whether or not the data has an explicit time column. */
+static double frame_time(int frame_index) {
+	if(app_data.explicit_time) {
+		return get_time_from_frame(app_data.frames[frame_index]);
+	}
+	return frame_index * app_data.dt;
+}
+
+static int scatter_pair_compare(const void *a, const void *b) {
+	const int *pa = a;
+	const int *pb = b;
+	return pa[1] - pb[1];
+}
+
+/* Compile the input maps into a scatter plan.  Pairs are sorted by
+ * destination slot so that applying a frame writes the body state array
+ * front to back. */
+static void scatter_plan_compile(scatter_plan_t *plan) {
+	int i;
+	int count = 0;
+	int (*pairs)[2] = malloc((app_data.num_input_maps + 1) * sizeof(pairs[0]));
+	if(pairs == NULL) {
+		ERROR("Error allocating scatter plan\n");
+		exit(-1);
+	}
+	for(i=0; i < app_data.num_input_maps; i++) {
+		input_map_t *map = app_data.input_maps[i];
+		if(map->dest_index < 0) {
+			continue; // time is handled separately
+		}
+		switch(map->data_type) {
+			case DATA_TYPE_DOUBLE:
+				pairs[count][0] = map->frame_byte_offset;
+				pairs[count][1] = map->dest_index;
+				count++;
+				break;
+			default:
+				ERROR("Unhandled data type!!!\n");
+				exit(-1);
+		}
+	}
+	qsort(pairs, count, sizeof(pairs[0]), scatter_pair_compare);
+
+	scatter_group_t *g = &plan->f64;
+	free(g->src);
+	free(g->dst);
+	g->src = malloc((count + 1) * sizeof(int));
+	g->dst = malloc((count + 1) * sizeof(int));
+	if(g->src == NULL || g->dst == NULL) {
+		ERROR("Error allocating scatter plan\n");
+		exit(-1);
+	}
+	for(i=0; i < count; i++) {
+		g->src[i] = pairs[i][0];
+		g->dst[i] = pairs[i][1];
+	}
+	g->count = count;
+	free(pairs);
+	DEBUG("Compiled scatter plan: %d double(s) per frame\n", count);
+}
+
+/* Split the bodies into those the data moves and those it doesn't, so the
+ * static ones can be culled with a grid that's only built once. */
+static void body_motion_compile(void) {
+	int i;
+	bool *moves = calloc(app_data.num_bodies + 1, sizeof(bool));
+	app_data.static_bodies = malloc((app_data.num_bodies + 1) * sizeof(int));
+	app_data.moving_bodies = malloc((app_data.num_bodies + 1) * sizeof(int));
+	if(moves == NULL || app_data.static_bodies == NULL || app_data.moving_bodies == NULL) {
+		ERROR("Error allocating body lists\n");
+		exit(-1);
+	}
+	for(i=0; i < app_data.plan.f64.count; i++) {
+		moves[app_data.plan.f64.dst[i] / BODY_STATE_SLOTS] = true;
+	}
+	app_data.num_static_bodies = 0;
+	app_data.num_moving_bodies = 0;
+	for(i=0; i < app_data.num_bodies; i++) {
+		// parents have lower indices, so they're already marked
+		const body_link_t *link = &app_data.body_links[i];
+		if((link->xy_parent >= 0 && moves[link->xy_parent]) || (link->theta_parent >= 0 && moves[link->theta_parent])) {
+			moves[i] = true;
+		}
+		if(moves[i]) {
+			app_data.moving_bodies[app_data.num_moving_bodies++] = i;
+		} else {
+			app_data.static_bodies[app_data.num_static_bodies++] = i;
+		}
+	}
+	free(moves);
+}
+
+static void scatter_plan_apply(scatter_plan_t *plan, frame_ptr_t pframe, double *state) {
+	int i;
+	const scatter_group_t *g = &plan->f64;
+	for(i=0; i < g->count; i++) {
+		state[g->dst[i]] = *((double *)(&pframe[g->src[i]]));
+	}
+}
+
+/* Motion trails ********************************************************
+ *
+ * Playing forward appends one point per frame to each trail.  A step of
+ * less than a trail's length either way (skipped frames during playback,
+ * stepping back) evaluates just the frames entering or leaving the trails.
+ * A longer jump marks the trails stale, and they're rebuilt (by evaluating
+ * the frames leading up to the current one) the next time they're drawn,
+ * so a burst of seeks costs one rebuild.  Both only evaluate the trail
+ * chain, not the whole scene.  Points are kept in ground coordinates, so a
+ * view change doesn't invalidate them. */
+
+/* List the trail bodies and every body their transforms depend on, in
+ * index order so parents come first. */
+static void trail_chain_compile(void) {
+	int i;
+	bool *needed = calloc(app_data.num_bodies + 1, sizeof(bool));
+	app_data.trail_chain = malloc((app_data.num_bodies + 1) * sizeof(int));
+	if(needed == NULL || app_data.trail_chain == NULL) {
+		ERROR("Error allocating trail chain\n");
+		exit(-1);
+	}
+	for(i=0; i < app_data.num_trails; i++) {
+		needed[app_data.trail_bodies[i]] = true;
+	}
+	// parents have lower indices, so one pass down marks every ancestor
+	for(i=app_data.num_bodies-1; i >= 0; i--) {
+		const body_link_t *link = &app_data.body_links[i];
+		if(!needed[i]) {
+			continue;
+		}
+		if(link->xy_parent >= 0) {
+			needed[link->xy_parent] = true;
+		}
+		if(link->theta_parent >= 0) {
+			needed[link->theta_parent] = true;
+		}
+	}
+	app_data.num_trail_chain = 0;
+	for(i=0; i < app_data.num_bodies; i++) {
+		if(needed[i]) {
+			app_data.trail_chain[app_data.num_trail_chain++] = i;
+		}
+	}
+	free(needed);
+}
+
+/* Evaluate the trail chain at frame f.  The rest of ss is left alone,
+ * except for the inputs, so evaluating the current frame again afterwards
+ * puts ss back as it was. */
+static void trails_eval_frame(scene_state_t *ss, int f) {
+	int k;
+	scatter_plan_apply(&app_data.plan, app_data.frames[f], (double *)ss->body_state);
+	for(k=0; k < app_data.num_trail_chain; k++) {
+		update_body_transform(ss, app_data.trail_chain[k]);
+	}
+}
+
+static void trails_push_current(scene_state_t *ss) {
+	int i;
+	for(i=0; i < app_data.num_trails; i++) {
+		body_t *body = app_data.bodies[app_data.trail_bodies[i]];
+		trail_t *t = &ss->trails[i];
+		int slot = (t->start + t->count) % body->trail_length;
+		transform_point(&ss->frame_to_gnd[body->index], body->trail_x, body->trail_y, &t->x[slot], &t->y[slot]);
+		if(t->count < body->trail_length) {
+			t->count++;
+		} else {
+			t->start = (t->start + 1) % body->trail_length;
+		}
+	}
+}
+
+// the current point of trail i, added as its oldest
+static void trails_push_oldest(scene_state_t *ss, int i) {
+	body_t *body = app_data.bodies[app_data.trail_bodies[i]];
+	trail_t *t = &ss->trails[i];
+	t->start = (t->start + body->trail_length - 1) % body->trail_length;
+	transform_point(&ss->frame_to_gnd[body->index], body->trail_x, body->trail_y, &t->x[t->start], &t->y[t->start]);
+	t->count++;
+}
+
+/* Take the trails back from ss->trail_frame to the earlier frame_index:
+ * drop the newer points, then refill each trail from older frames. */
+static void trails_step_back(scene_state_t *ss, int frame_index) {
+	int i, f;
+	int k = ss->trail_frame - frame_index;
+	for(i=0; i < app_data.num_trails; i++) {
+		ss->trails[i].count -= MIN(k, ss->trails[i].count);
+	}
+	// each trail needs the frames just before its oldest point, until it's full
+	bool evaluated = false;
+	for(f=frame_index; f >= 0 && f > frame_index - app_data.max_trail_length; f--) {
+		bool needed = false;
+		for(i=0; i < app_data.num_trails; i++) {
+			const trail_t *t = &ss->trails[i];
+			if(t->count < app_data.bodies[app_data.trail_bodies[i]]->trail_length && frame_index - t->count == f) {
+				needed = true;
+			}
+		}
+		if(!needed) {
+			continue;
+		}
+		if(f != frame_index) {
+			trails_eval_frame(ss, f);
+			evaluated = true;
+		}
+		for(i=0; i < app_data.num_trails; i++) {
+			const trail_t *t = &ss->trails[i];
+			if(t->count < app_data.bodies[app_data.trail_bodies[i]]->trail_length && frame_index - t->count == f) {
+				trails_push_oldest(ss, i);
+			}
+		}
+	}
+	if(evaluated) {
+		trails_eval_frame(ss, frame_index);
+	}
+}
+
+/* Called after ss has been evaluated at frame_index, with frames_lock held
+ * when not on the main thread. */
+static void trails_advance(scene_state_t *ss, int frame_index) {
+	int f;
+	int step = frame_index - ss->trail_frame;
+	if(app_data.num_trails == 0 || step == 0) {
+		return;
+	}
+	if(!ss->trails_valid || abs(step) >= app_data.max_trail_length) {
+		ss->trails_valid = false;
+	} else if(step > 0) {
+		for(f=ss->trail_frame + 1; f < frame_index; f++) {
+			trails_eval_frame(ss, f);
+			trails_push_current(ss);
+		}
+		if(step > 1) {
+			trails_eval_frame(ss, frame_index);
+		}
+		trails_push_current(ss);
+	} else {
+		trails_step_back(ss, frame_index);
+	}
+	ss->trail_frame = frame_index;
+}
+
+/* Refill the trails from the frames up to ss->trail_frame.  That frame is
+ * evaluated last, so ss is left as it was. */
+static void trails_rebuild(scene_state_t *ss) {
+	int i, f;
+	if(ss->trails == NULL) {
+		ss->trails = calloc(app_data.num_trails, sizeof(trail_t));
+		if(ss->trails == NULL) {
+			ERROR("Error allocating trails\n");
+			exit(-1);
+		}
+		for(i=0; i < app_data.num_trails; i++) {
+			int length = app_data.bodies[app_data.trail_bodies[i]]->trail_length;
+			ss->trails[i].x = malloc(length * sizeof(double));
+			ss->trails[i].y = malloc(length * sizeof(double));
+			if(ss->trails[i].x == NULL || ss->trails[i].y == NULL) {
+				ERROR("Error allocating trails\n");
+				exit(-1);
+			}
+		}
+	}
+	for(i=0; i < app_data.num_trails; i++) {
+		ss->trails[i].start = 0;
+		ss->trails[i].count = 0;
+	}
+
+	// this runs outside scene_state_load_frame(), so take the frames lock here
+	pthread_rwlock_rdlock(&app_data.frames_lock);
+	if(app_data.num_frames == 0) {
+		trails_push_current(ss);
+	} else {
+		f = ss->trail_frame - app_data.max_trail_length + 1;
+		for(f = (f > 0) ? f : 0; f <= ss->trail_frame; f++) {
+			trails_eval_frame(ss, f);
+			trails_push_current(ss);
+		}
+	}
+	pthread_rwlock_unlock(&app_data.frames_lock);
+	ss->trails_valid = true;
+}
+
+static void update_bodies(void) {
+	frame_ptr_t pframe = app_data.frames[app_data.active_frame_index];
+
+	// copy the frame into the packed body state array
+	scatter_plan_apply(&app_data.plan, pframe, (double *)app_data.scene.body_state);
+	if(app_data.explicit_time) {
+		app_data.time = get_time_from_frame(pframe);
+	}
+
+	update_body_transforms(&app_data.scene);
+	trails_advance(&app_data.scene, app_data.active_frame_index);
+}
+
+#if USE_PLOTS
+/* Channel plots ******************************************************/
+
+#define PLOT_HEIGHT_PX 150
+// widest a plot is fed for; it keeps up to two runs per pixel, each two trace points
+#define PLOT_MAX_WIDTH 2048
+#define PLOT_MAX_RUNS (2 * PLOT_MAX_WIDTH)
+
+static double frame_value(int frame_index, const input_map_t *map) {
+	return *((double *)(&app_data.frames[frame_index][map->frame_byte_offset]));
+}
+
+// a followed by b
+static plot_run_t plot_run_merge(const input_map_t *map, plot_run_t a, plot_run_t b) {
+	plot_run_t m;
+	m.lo = (frame_value(b.lo, map) < frame_value(a.lo, map)) ? b.lo : a.lo;
+	m.hi = (frame_value(b.hi, map) > frame_value(a.hi, map)) ? b.hi : a.hi;
+	return m;
+}
+
+static int plot_window_first_frame(void) {
+	if(!(app_data.plot_window > 0)) {
+		return 0;
+	}
+	double t_start = frame_time(app_data.num_frames - 1) - app_data.plot_window;
+	int lo = 0, hi = app_data.num_frames - 1;
+	while(lo < hi) {
+		int mid = (lo + hi) / 2;
+		if(frame_time(mid) < t_start) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* Halve the number of runs by merging neighbours.  An odd one out is only
+ * half of a new run, so it goes back into the tail. */
+static void plot_channel_merge_runs(plot_channel_t *pc) {
+	int i;
+	for(i=0; 2*i + 1 < pc->num_runs; i++) {
+		pc->runs[i] = plot_run_merge(pc->map, pc->runs[2*i], pc->runs[2*i + 1]);
+	}
+	if(pc->num_runs % 2) {
+		plot_run_t last = pc->runs[pc->num_runs - 1];
+		pc->tail = pc->tail_frames ? plot_run_merge(pc->map, last, pc->tail) : last;
+		pc->tail_frames += pc->run_frames;
+	}
+	pc->num_runs /= 2;
+	pc->run_frames *= 2;
+	pc->num_fed = 0;
+}
+
+/* Drop the runs that have scrolled out of the window.  Dropping means
+ * refilling the trace, so unless forced it waits for a quarter width's
+ * worth; until then the axis range hides them. */
+static void plot_channel_scroll(plot_channel_t *pc, bool force) {
+	double t_start = frame_time(app_data.num_frames - 1) - app_data.plot_window;
+	int n = 0;
+	while(n < pc->num_runs && frame_time(MAX(pc->runs[n].lo, pc->runs[n].hi)) < t_start) {
+		n++;
+	}
+	if(n == 0 || (n < pc->width / 4 && !force)) {
+		return;
+	}
+	memmove(pc->runs, pc->runs + n, (pc->num_runs - n) * sizeof(pc->runs[0]));
+	pc->num_runs -= n;
+	pc->num_fed = 0;
+}
+
+/* Fold in the frames that arrived since the last call and bring the trace
+ * up to date.  Amortized, this is constant work per frame. */
+static void plot_channel_update(plot_channel_t *pc) {
+	int i;
+	if(pc->width == 0) {
+		return;
+	}
+	for(i=pc->next_frame; i < app_data.num_frames; i++) {
+		plot_run_t r = {i, i};
+		pc->tail = pc->tail_frames ? plot_run_merge(pc->map, pc->tail, r) : r;
+		if(++pc->tail_frames < pc->run_frames) {
+			continue;
+		}
+		pc->runs[pc->num_runs++] = pc->tail;
+		pc->tail_frames = 0;
+		if(pc->num_runs > 2 * pc->width) {
+			if(app_data.plot_window > 0) {
+				plot_channel_scroll(pc, true);
+			}
+			if(pc->num_runs > 2 * pc->width) {
+				plot_channel_merge_runs(pc);
+			}
+		}
+	}
+	pc->next_frame = app_data.num_frames;
+	if(app_data.plot_window > 0) {
+		plot_channel_scroll(pc, false);
+	}
+
+	if(pc->num_fed == 0) {
+		jbplot_trace_clear_data(pc->trace);
+	}
+	for(i=pc->num_fed; i < pc->num_runs; i++) {
+		int first = MIN(pc->runs[i].lo, pc->runs[i].hi);
+		int second = MAX(pc->runs[i].lo, pc->runs[i].hi);
+		jbplot_trace_add_point(pc->trace, frame_time(first), frame_value(first, pc->map));
+		if(second != first) {
+			jbplot_trace_add_point(pc->trace, frame_time(second), frame_value(second, pc->map));
+		}
+	}
+	pc->num_fed = pc->num_runs;
+	if(app_data.plot_window > 0) {
+		double t_end = frame_time(app_data.num_frames - 1);
+		jbplot_set_x_axis_range(JBPLOT(pc->plot), t_end - app_data.plot_window, t_end);
+	}
+}
+
+static void plot_size_allocate_cb(GtkWidget *widget, GtkAllocation *allocation, gpointer data) {
+	plot_channel_t *pc = data;
+	int width = CLAMP(allocation->width, 1, PLOT_MAX_WIDTH);
+	if(width == pc->width) {
+		return;
+	}
+	// the runs are sized for the old width, so start over from the frames
+	pc->width = width;
+	pc->next_frame = plot_window_first_frame();
+	pc->run_frames = 1;
+	pc->num_runs = 0;
+	pc->num_fed = 0;
+	pc->tail_frames = 0;
+	plot_channel_update(pc);
+	gtk_widget_queue_draw(widget);
+}
+
+static void input_map_describe(const input_map_t *map, char *str, size_t size) {
+	body_t *body = app_data.bodies[map->dest_index / BODY_STATE_SLOTS];
+	int slot = map->dest_index % BODY_STATE_SLOTS;
+	const char *field = 
+		(slot == offsetof(body_state_t, x) / sizeof(double)) ? "x" : 
+		(slot == offsetof(body_state_t, y) / sizeof(double)) ? "y" : "theta";
+	if(body->name != NULL && body->name[0] != '\0') {
+		snprintf(str, size, "%s %s (column %d)", body->name, field, map->field_num);
+	} else {
+		snprintf(str, size, "body %d %s (column %d)", body->id, field, map->field_num);
+	}
+}
+
+/* Add a plot to box for each mapped column with plot="true" (the default). */
+static void plots_init(GtkWidget *box) {
+	gui_t *gp = &app_data.gui;
+	int i;
+	rgb_color_t cursor_color = {1.0, 0.0, 0.0};
+	gp->plots = NULL;
+	gp->num_plots = 0;
+	if(app_data.num_frames < 1) {
+		return;
+	}
+	gp->plots = calloc(app_data.num_input_maps, sizeof(gp->plots[0]));
+	if(gp->plots == NULL) {
+		ERROR("Error allocating plots\n");
+		exit(-1);
+	}
+	for(i=0; i < app_data.num_input_maps; i++) {
+		input_map_t *map = app_data.input_maps[i];
+		if(map->dest_index < 0 || !map->plot) {
+			continue;
+		}
+		plot_channel_t *pc = &gp->plots[gp->num_plots++];
+		char title[100];
+		input_map_describe(map, title, sizeof(title));
+		pc->map = map;
+		pc->width = 0;
+		pc->runs = malloc((PLOT_MAX_RUNS + 1) * sizeof(pc->runs[0]));
+		if(pc->runs == NULL) {
+			ERROR("Error allocating plots\n");
+			exit(-1);
+		}
+		pc->plot = jbplot_new();
+		gtk_widget_set_size_request(pc->plot, -1, PLOT_HEIGHT_PX);
+		jbplot_set_plot_title(JBPLOT(pc->plot), title, 1);
+		jbplot_set_x_axis_label(JBPLOT(pc->plot), "time", 1);
+		jbplot_set_cursor_props(JBPLOT(pc->plot), CURSOR_VERT, cursor_color, 1.0, LINETYPE_SOLID);
+		pc->trace = jbplot_create_trace(2 * (PLOT_MAX_RUNS + 1));
+		jbplot_trace_set_name(pc->trace, title);
+		jbplot_add_trace(JBPLOT(pc->plot), pc->trace);
+		g_signal_connect(pc->plot, "size-allocate", G_CALLBACK(plot_size_allocate_cb), pc);
+		gtk_box_pack_start(GTK_BOX(box), pc->plot, FALSE, FALSE, 0);
+	}
+}
+
+/* Feed the plots the frames appended since the last call. */
+static void plots_append(void) {
+	gui_t *gp = &app_data.gui;
+	int i;
+	for(i=0; i < gp->num_plots; i++) {
+		plot_channel_update(&gp->plots[i]);
+		gtk_widget_queue_draw(gp->plots[i].plot);
+	}
+}
+
+static void plots_set_cursor(int frame_index) {
+	gui_t *gp = &app_data.gui;
+	int i;
+	for(i=0; i < gp->num_plots; i++) {
+		plot_channel_t *pc = &gp->plots[i];
+		jbplot_set_cursor_pos(JBPLOT(pc->plot), frame_time(frame_index), frame_value(frame_index, pc->map));
+		gtk_widget_queue_draw(pc->plot);
+	}
+}
+#endif
+
+static void render_thread_seek(render_thread_t *rt, int frame_index, gint64 seek_start);
+
+/* Bring the canvas up to date with the active frame: either evaluate it
+ * here and redraw, or hand it to the render thread. */
+static void show_active_frame(void) {
+	render_thread_t *rt = app_data.gui.render_thread;
+	quality_motion();
+	#if USE_PLOTS
+	plots_set_cursor(app_data.active_frame_index);
+	#endif
+	if(rt == NULL) {
+		if(app_data.num_frames > 0) {
+			update_bodies();
+		} else {
+			update_body_transforms(&app_data.scene);
+		}
+		queue_scene_redraw();
+		return;
+	}
+	if(app_data.num_frames > 0 && app_data.explicit_time) {
+		app_data.time = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
+	}
+	render_thread_seek(rt, app_data.active_frame_index, app_data.gui.seek_start);
+	app_data.gui.seek_start = 0; // the render thread measures it from here
+}
+
+static gboolean seek_idle_cb(gpointer data) {
+	gui_t *gp = &app_data.gui;
+	gp->seek_idle = 0;
+	gp->stats.seeks_dropped += gp->seeks_queued - 1;
+	gp->seeks_queued = 0;
+	show_active_frame();
+	return FALSE;
+}
+
+/* Slider seeks are coalesced: each event just moves the target frame, and
+ * the frame is evaluated once from an idle handler.  Its priority is below
+ * input events (so a burst of them is drained first) but above redraws (so
+ * the frame is drawn in the same main loop iteration). */
+static void request_seek(void) {
+	gui_t *gp = &app_data.gui;
+	if(gp->seek_start == 0) {
+		gp->seek_start = g_get_monotonic_time();
+	}
+	gp->seeks_queued++;
+	if(gp->seek_idle == 0) {
+		gp->seek_idle = g_idle_add_full(G_PRIORITY_HIGH_IDLE + 10, seek_idle_cb, NULL, NULL);
+	}
 }
 
 gboolean update_func(gpointer data) {
 
-	if(app_data.num_frames < 2) {
-		if(app_data.num_frames == 1) {
-			update_bodies();
+	if(app_data.num_frames < 2) {
+		show_active_frame();
+		return FALSE;
+	}
+
+	if(app_data.paused) {
+		return TRUE;
+	}
+
+	show_active_frame();
+
+	// set the slider value
+	if(app_data.explicit_time) {
+		app_data.time = 
+			get_time_from_frame(app_data.frames[app_data.active_frame_index]);
+	} else {
+		app_data.time = app_data.dt * app_data.active_frame_index;
+	}
+	gtk_range_set_value((GtkRange *)app_data.gui.slider, app_data.time);
+	char str[50];
+	sprintf(str, "t=%g", app_data.time);
+	gtk_label_set_text((GtkLabel*)app_data.gui.time, str);
+
+	// advance frame counter
+	// If we get to the end (last frame), start over at the beginning
+	app_data.active_frame_index++;
+	if(app_data.active_frame_index >= app_data.num_frames) {
+		//app_data.active_frame_index = app_data.num_frames - 1;
+		app_data.active_frame_index = 0;
+	}
+
+	return TRUE;
+}
+
+void button_activate(GtkButton *b, gpointer data) {
+	app_data.paused = !app_data.paused;
+	if(app_data.paused) {
+		GtkWidget *im = gtk_button_get_image(b);
+		gtk_image_set_from_stock(
+			(GtkImage *)im, 
+			GTK_STOCK_MEDIA_PLAY, 
+			GTK_ICON_SIZE_SMALL_TOOLBAR
+		);
+	}
+	else {
+		GtkWidget *im = gtk_button_get_image(b);
+		gtk_image_set_from_stock(
+			(GtkImage *)im, 
+			GTK_STOCK_MEDIA_PAUSE, 
+			GTK_ICON_SIZE_SMALL_TOOLBAR
+		);
+	}
+	return;
+}
+
+void slider_changed_cb(GtkRange *range, gpointer  user_data) {
+	//printf("slider changed!\n");
+}
+
+gboolean slider_changed2_cb (
+		GtkRange *range,
+		GtkScrollType scroll,
+		gdouble value, 
+		gpointer user_data) 
+{
+	//printf("slider changed 2!\n");
+
+	// if NOT paused, prevent user from moving the slider
+	if(!app_data.paused) {
+		return TRUE;
+	}
+
+	// Otherwise (we must be paused)
+	//printf("scroll type: %d\n", scroll);
+	switch(scroll) {
+	case GTK_SCROLL_JUMP:
+		// set the active frame index and time based on slider position
+		if(app_data.explicit_time) {
+			int frame_index = (value - app_data.t_min)/(app_data.t_max - app_data.t_min) * app_data.num_frames;
+			if (frame_index < 0)
+				frame_index = 0;
+			else if( frame_index >= app_data.num_frames)
+				frame_index = app_data.num_frames - 1;
+			double t = get_time_from_frame(app_data.frames[frame_index]);
+			double delta= fabs(t - value);
+			if(t < value) {
+				while(1) {
+					if( (frame_index+1) >= app_data.num_frames) {
+						break;
+					}
+					double t_next = get_time_from_frame(app_data.frames[frame_index + 1]);
+					double delta_next = fabs(t_next - value);
+					if(delta_next > delta) {
+						break;
+					}
+					t = t_next;
+					delta = delta_next;
+					frame_index++;
+				}
+			}
+			else if(t > value) {
+				while(t > value) {
+					if(frame_index <= 0) {
+						break;
+					}
+					double t_next = get_time_from_frame(app_data.frames[frame_index - 1]);
+					double delta_next = fabs(t_next - value);
+					if(delta_next > delta) {
+						break;
+					}
+					t = t_next;
+					delta = delta_next;
+					frame_index--;
+				}
+			}
+			app_data.active_frame_index = frame_index;
+			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
+		}
+		else {
+			int frame_index = (value - app_data.t_min)/(app_data.t_max - app_data.t_min) * app_data.num_frames;
+			if (frame_index < 0)
+				frame_index = 0;
+			else if( frame_index >= app_data.num_frames)
+				frame_index = app_data.num_frames - 1;
+			app_data.active_frame_index = frame_index;
+			gtk_range_set_value((GtkRange *)app_data.gui.slider, app_data.active_frame_index * app_data.dt);
+		}
+		break;
+	case GTK_SCROLL_STEP_FORWARD:
+		{
+			app_data.active_frame_index++;
+			if(app_data.active_frame_index >= app_data.num_frames) {
+				app_data.active_frame_index = app_data.num_frames - 1;
+			}
+			double t;
+			if(app_data.explicit_time) {
+				t = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
+			} else {
+				t = app_data.active_frame_index * app_data.dt;
+			}
+			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
+			break;
+		}
+	case GTK_SCROLL_STEP_BACKWARD:
+		{
+			app_data.active_frame_index--;
+			if(app_data.active_frame_index < 0) {
+				app_data.active_frame_index = 0;
+			}
+			double t;
+			if(app_data.explicit_time) {
+				t = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
+			} else {
+				t = app_data.active_frame_index * app_data.dt;
+			}
+			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
+			break;
+		}
+	case GTK_SCROLL_PAGE_FORWARD:
+		{
+			app_data.active_frame_index += 10;
+			if(app_data.active_frame_index >= app_data.num_frames) {
+				app_data.active_frame_index = app_data.num_frames - 1;
+			}
+			double t;
+			if(app_data.explicit_time) {
+				t = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
+			} else {
+				t = app_data.active_frame_index * app_data.dt;
+			}
+			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
+			break;
+		}
+	case GTK_SCROLL_PAGE_BACKWARD:
+		{
+			app_data.active_frame_index -= 10;
+			if(app_data.active_frame_index < 0) {
+				app_data.active_frame_index = 0;
+			}
+			double t;
+			if(app_data.explicit_time) {
+				t = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
+			} else {
+				t = app_data.active_frame_index * app_data.dt;
+			}
+			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
+			break;
+		}
+	case GTK_SCROLL_START:
+		{
+			app_data.active_frame_index = 0;
+			double t;
+			if(app_data.explicit_time) {
+				t = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
+			} else {
+				t = app_data.active_frame_index * app_data.dt;
+			}
+			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
+			break;
+		}
+	case GTK_SCROLL_END:
+		{
+			app_data.active_frame_index = app_data.num_frames - 1;
+			double t;
+			if(app_data.explicit_time) {
+				t = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
+			} else {
+				t = app_data.active_frame_index * app_data.dt;
+			}
+			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
+			break;
+		}
+	default:
+		return TRUE;
+	}
+	request_seek();
+	char str[50];
+	sprintf(str, "t=%g", frame_time(app_data.active_frame_index));
+	gtk_label_set_text((GtkLabel*)app_data.gui.time, str);
+
+	return TRUE;
+}
+
+// each mouse wheel notch zooms by this factor
+#define ZOOM_STEP 1.25
+// limits on the visible x span, relative to the configured one
+#define ZOOM_MIN_SPAN 1e-5
+#define ZOOM_MAX_SPAN 1e3
+
+static void view_changed(void) {
+	render_thread_t *rt = app_data.gui.render_thread;
+	if(rt) {
+		render_thread_refresh(rt);
+	} else {
+		gtk_widget_queue_draw(app_data.gui.canvas);
+	}
+}
+
+/* Zoom in by factor (out if < 1), keeping the point under canvas pixel
+ * (x_px, y_px) in place. */
+static void view_zoom(double factor, double x_px, double y_px) {
+	view_t v;
+	current_view(&v);
+	double span = (app_data.x_range.max - app_data.x_range.min) / factor;
+	double home_span = app_data.home_x_range.max - app_data.home_x_range.min;
+	if(fabs(span) < ZOOM_MIN_SPAN * fabs(home_span) || fabs(span) > ZOOM_MAX_SPAN * fabs(home_span)) {
+		return;
+	}
+	double x = (x_px - v.x_b) / v.x_m;
+	double y = (y_px - v.y_b) / v.y_m;
+	app_data.x_range.min = x + (app_data.x_range.min - x) / factor;
+	app_data.x_range.max = x + (app_data.x_range.max - x) / factor;
+	app_data.y_range.min = y + (app_data.y_range.min - y) / factor;
+	app_data.y_range.max = y + (app_data.y_range.max - y) / factor;
+	view_changed();
+}
+
+/* Move the view so the scene follows the pointer by (dx_px, dy_px). */
+static void view_pan(double dx_px, double dy_px) {
+	view_t v;
+	current_view(&v);
+	double dx = dx_px / v.x_m;
+	double dy = dy_px / v.y_m;
+	app_data.x_range.min -= dx;
+	app_data.x_range.max -= dx;
+	app_data.y_range.min -= dy;
+	app_data.y_range.max -= dy;
+	view_changed();
+}
+
+gboolean canvas_scroll_cb(GtkWidget *widget, GdkEventScroll *event, gpointer data) {
+	if(event->direction == GDK_SCROLL_UP) {
+		view_zoom(ZOOM_STEP, event->x, event->y);
+	} else if(event->direction == GDK_SCROLL_DOWN) {
+		view_zoom(1.0 / ZOOM_STEP, event->x, event->y);
+	}
+	return TRUE;
+}
+
+gboolean canvas_button_press_cb(GtkWidget *widget, GdkEventButton *event, gpointer data) {
+	gui_t *gp = &app_data.gui;
+	if(event->button != 1) {
+		return FALSE;
+	}
+	if(event->type == GDK_2BUTTON_PRESS) {
+		// back to the configured view
+		gp->dragging = false;
+		app_data.x_range = app_data.home_x_range;
+		app_data.y_range = app_data.home_y_range;
+		view_changed();
+		return TRUE;
+	}
+	gp->dragging = true;
+	gp->drag_x = event->x;
+	gp->drag_y = event->y;
+	return TRUE;
+}
+
+gboolean canvas_motion_cb(GtkWidget *widget, GdkEventMotion *event, gpointer data) {
+	gui_t *gp = &app_data.gui;
+	if(!gp->dragging || !(event->state & GDK_BUTTON1_MASK)) {
+		gp->dragging = false;
+		return FALSE;
+	}
+	view_pan(event->x - gp->drag_x, event->y - gp->drag_y);
+	gp->drag_x = event->x;
+	gp->drag_y = event->y;
+	return TRUE;
+}
+
+gboolean canvas_button_release_cb(GtkWidget *widget, GdkEventButton *event, gpointer data) {
+	if(event->button == 1) {
+		app_data.gui.dragging = false;
+	}
+	return FALSE;
+}
+
+
+/* Record and draw one complete frame, without any of the caching done by
+ * draw_canvas().  The static content comes from tiles if given, drawing
+ * any that are missing; likewise for body sprites. */
+static void render_frame(draw_ptr dp, dlist_t *dl, scene_state_t *ss, range_t x_range, range_t y_range, 
+	bool overlay, int quality, tile_cache_t *tiles, sprite_cache_t *sprites, render_stats_t *stats) {
+	draw_start(dp);
+	float width, height;
+	draw_get_canvas_dims(dp, &width, &height);
+	view_t view;
+	view_make(&view, width, height, x_range, y_range);
+
+	dl_clear(dl);
+	draw_set_quality(dp, DRAW_QUALITY_BEST);
+	if(tiles && tile_cache_draw(tiles, dp, &view, MAX_TILES) == 0) {
+		stats->grounds_drawn = 0;
+		stats->grounds_culled = 0;
+	} else {
+		render_static(dl, &view, stats);
+	}
+	if(sprites) {
+		sprites->dp = dp;
+	}
+	render_scene(dl, ss, &view, quality, sprites, stats);
+	dl_sort_by_state(dl);
+	if(overlay) {
+		render_overlay(dl, stats);
+	}
+	draw_set_quality(dp, quality);
+	dl_replay(dl, dp);
+	draw_finish(dp);
+}
+
+static int parse_size(const char *str, int *width, int *height) {
+	char c;
+	if(sscanf(str, "%dx%d%c", width, height, &c) != 2 || *width <= 0 || *height <= 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Pick every stride-th frame with a time in [t_start, t_end].  With no
+ * data there is still one frame to draw (the configured positions), which
+ * is given index 0.  Returns the number of frames; *indices is malloc'd. */
+static int select_frames(int stride, double t_start, double t_end, int **indices) {
+	int capacity = (app_data.num_frames > 0) ? app_data.num_frames : 1;
+	*indices = malloc(capacity * sizeof((*indices)[0]));
+	if(*indices == NULL) {
+		ERROR("Error allocating frame list\n");
+		exit(-1);
+	}
+	if(app_data.num_frames == 0) {
+		(*indices)[0] = 0;
+		return 1;
+	}
+	int i, count = 0;
+	for(i=0; i < app_data.num_frames; i += stride) {
+		double t = frame_time(i);
+		if(t >= t_start && t <= t_end) {
+			(*indices)[count++] = i;
+		}
+	}
+	return count;
+}
+
+/* Evaluate a frame into ss.  Unlike update_bodies(), this doesn't touch
+ * app_data, so it can run on any thread with its own scene state. */
+static void scene_state_load_frame(scene_state_t *ss, int frame_index) {
+	pthread_rwlock_rdlock(&app_data.frames_lock);
+	if(app_data.num_frames > 0) {
+		scatter_plan_apply(&app_data.plan, app_data.frames[frame_index], (double *)ss->body_state);
+	}
+	update_body_transforms(ss);
+	trails_advance(ss, frame_index);
+	pthread_rwlock_unlock(&app_data.frames_lock);
+}
+
+/* Headless mode: render every stride-th frame with a time in [t_start,
+ * t_end] to dir/frame_NNNNNN.png (numbered by frame index).  GTK is never
+ * initialized. */
+static int render_out(const char *dir, int width, int height, int stride, double t_start, double t_end) {
+	draw_ptr dp = draw_create_image(width, height);
+	if(dp == NULL) {
+		ERROR("This draw backend can't render offscreen; use modviz_cairo or modviz_soft.\n");
+		return -1;
+	}
+	if(mkdir(dir, 0777) && errno != EEXIST) {
+		ERROR("Error creating output directory: %s\n", dir);
+		draw_destroy(dp);
+		return -1;
+	}
+
+	dlist_t dl;
+	dl_init(&dl);
+	render_stats_t stats;
+	char *path = malloc(strlen(dir) + 32);
+	if(path == NULL) {
+		ERROR("Error allocating path\n");
+		exit(-1);
+	}
+
+	int ret = 0;
+	int count = 0;
+	int *indices;
+	int num_frames = select_frames(stride, t_start, t_end, &indices);
+	int i;
+	for(i=0; i < num_frames; i++) {
+		scene_state_load_frame(&app_data.scene, indices[i]);
+		render_frame(dp, &dl, &app_data.scene, app_data.x_range, app_data.y_range, false, DRAW_QUALITY_BEST, NULL, NULL, &stats);
+
+		sprintf(path, "%s/frame_%06d.png", dir, indices[i]);
+		if(draw_image_write_png(dp, path)) {
+			ERROR("Error writing %s\n", path);
+			ret = -1;
+			break;
+		}
+		count++;
+	}
+	printf("Wrote %d frames to %s\n", count, dir);
+
+	free(indices);
+	free(path);
+	dl_destroy(&dl);
+	draw_destroy(dp);
+	return ret;
+}
+
+/* Parallel export *****************************************************
+ *
+ * Each worker thread owns a copy of the scene state and an image drawer.
+ * Output frames are handed out in order, each into a slot of a ring
+ * buffer.  The calling thread writes the slots out in order as they
+ * complete, so the stream is ordered no matter which worker finishes
+ * first, and at most num_slots frames are held in memory. */
+
+typedef enum {
+	EXPORT_Y4M,
+	EXPORT_PPM
+} export_format_enum;
+
+typedef struct {
+	int seq;    // output frame held by this slot, -1 when free
+	bool ready; // rendered and encoded, waiting to be written
+	unsigned char *data;
+} export_slot_t;
+
+typedef struct {
+	export_format_enum format;
+	int width;
+	int height;
+	int frame_bytes;
+	int *frame_indices;
+	int num_frames;
+
+	export_slot_t *slots;
+	int num_slots;
+	int next_job;   // next output frame to give to a worker
+	bool failed;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} export_job_t;
+
+typedef struct {
+	export_job_t *job;
+	pthread_t thread;
+	draw_ptr dp;
+	scene_state_t ss;
+	dlist_t dl;
+	render_stats_t stats;
+} export_worker_t;
+
+/* Convert the rendered image to the output pixel format: packed RGB for
+ * PPM, or full resolution (4:4:4) Y, Cb and Cr planes (BT.601) for Y4M. */
+static void export_encode(export_job_t *job, draw_ptr dp, unsigned char *out) {
+	int stride;
+	unsigned char *data = draw_image_get_data(dp, &stride);
+	int n = job->width * job->height;
+	unsigned char *y_plane = out;
+	unsigned char *u_plane = out + n;
+	unsigned char *v_plane = out + 2 * n;
+	int row, col;
+	for(row=0; row < job->height; row++) {
+		const uint32_t *px = (const uint32_t *)(data + row * stride);
+		for(col=0; col < job->width; col++) {
+			int r = (px[col] >> 16) & 0xFF;
+			int g = (px[col] >> 8) & 0xFF;
+			int b = px[col] & 0xFF;
+			if(job->format == EXPORT_PPM) {
+				*out++ = r;
+				*out++ = g;
+				*out++ = b;
+			} else {
+				*y_plane++ = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+				*u_plane++ = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+				*v_plane++ = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+			}
+		}
+	}
+}
+
+static void *export_worker_main(void *data) {
+	export_worker_t *w = data;
+	export_job_t *job = w->job;
+
+	pthread_mutex_lock(&job->lock);
+	for(;;) {
+		// wait until the next frame's slot has been written out
+		while(!job->failed && job->next_job < job->num_frames &&
+			job->slots[job->next_job % job->num_slots].seq != -1) {
+			pthread_cond_wait(&job->cond, &job->lock);
+		}
+		if(job->failed || job->next_job >= job->num_frames) {
+			break;
+		}
+		int seq = job->next_job++;
+		export_slot_t *slot = &job->slots[seq % job->num_slots];
+		slot->seq = seq;
+		slot->ready = false;
+		pthread_mutex_unlock(&job->lock);
+
+		scene_state_load_frame(&w->ss, job->frame_indices[seq]);
+		render_frame(w->dp, &w->dl, &w->ss, app_data.x_range, app_data.y_range, false, DRAW_QUALITY_BEST, NULL, NULL, &w->stats);
+		export_encode(job, w->dp, slot->data);
+
+		pthread_mutex_lock(&job->lock);
+		slot->ready = true;
+		pthread_cond_broadcast(&job->cond);
+	}
+	pthread_mutex_unlock(&job->lock);
+	return NULL;
+}
+
+static int export_write_frame(export_job_t *job, FILE *fp, const unsigned char *data) {
+	if(job->format == EXPORT_PPM) {
+		fprintf(fp, "P6\n%d %d\n255\n", job->width, job->height);
+	} else {
+		fputs("FRAME\n", fp);
+	}
+	return fwrite(data, 1, job->frame_bytes, fp) == (size_t)job->frame_bytes ? 0 : -1;
+}
+
+/* Render the selected frames on num_threads threads and write them to fp
+ * as one uncompressed Y4M or PPM stream.  fp is closed when done. */
+static int export_video(FILE *fp, const char *filename, export_format_enum format, int width, int height, 
+	int fps, int num_threads, int stride, double t_start, double t_end) {
+	int i;
+	export_job_t job;
+	memset(&job, 0, sizeof(job));
+	job.format = format;
+	job.width = width;
+	job.height = height;
+	job.frame_bytes = 3 * width * height;
+	job.num_frames = select_frames(stride, t_start, t_end, &job.frame_indices);
+
+	if(num_threads < 1) {
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if(num_threads < 1) {
+			num_threads = 1;
+		}
+	}
+
+	/* Polygon level of detail is cached on the (shared) polygons.  Every
+	 * frame uses the same view, so fill the cache now; the workers then
+	 * only read it. */
+	view_t view;
+	view_make(&view, width, height, app_data.x_range, app_data.y_range);
+	for(i=0; i < app_data.num_bodies; i++) {
+		if(app_data.bodies[i]->type == BODY_TYPE_POLYGON) {
+			int count;
+			double *x, *y;
+			polygon_lod_nodes((polygon_t *)app_data.bodies[i], fabs(view.x_m), &count, &x, &y);
+		}
+	}
+
+	job.num_slots = 2 * num_threads;
+	job.slots = malloc(job.num_slots * sizeof(job.slots[0]));
+	export_worker_t *workers = calloc(num_threads, sizeof(workers[0]));
+	if(job.slots == NULL || workers == NULL) {
+		ERROR("Error allocating export buffers\n");
+		exit(-1);
+	}
+	for(i=0; i < job.num_slots; i++) {
+		job.slots[i].seq = -1;
+		job.slots[i].ready = false;
+		job.slots[i].data = malloc(job.frame_bytes);
+		if(job.slots[i].data == NULL) {
+			ERROR("Error allocating export buffers\n");
+			exit(-1);
+		}
+	}
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	for(i=0; i < num_threads; i++) {
+		export_worker_t *w = &workers[i];
+		w->job = &job;
+		w->dp = draw_create_image(width, height);
+		if(w->dp == NULL) {
+			ERROR("This draw backend can't render offscreen; use modviz_cairo or modviz_soft.\n");
+			exit(-1);
+		}
+		scene_state_clone(&w->ss, &app_data.scene);
+		dl_init(&w->dl);
+	}
+
+	if(format == EXPORT_Y4M) {
+		fprintf(fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+	}
+	for(i=0; i < num_threads; i++) {
+		if(pthread_create(&workers[i].thread, NULL, export_worker_main, &workers[i])) {
+			ERROR("Error starting export thread\n");
+			exit(-1);
+		}
+	}
+
+	// write the frames out in order as they become ready
+	int ret = 0;
+	int seq;
+	pthread_mutex_lock(&job.lock);
+	for(seq=0; seq < job.num_frames; seq++) {
+		export_slot_t *slot = &job.slots[seq % job.num_slots];
+		while(!(slot->seq == seq && slot->ready)) {
+			pthread_cond_wait(&job.cond, &job.lock);
+		}
+		pthread_mutex_unlock(&job.lock);
+		int err = export_write_frame(&job, fp, slot->data);
+		pthread_mutex_lock(&job.lock);
+		slot->seq = -1;
+		pthread_cond_broadcast(&job.cond);
+		if(err) {
+			ERROR("Error writing export file: %s\n", filename);
+			job.failed = true;
+			ret = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&job.lock);
+
+	for(i=0; i < num_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		draw_destroy(workers[i].dp);
+		scene_state_free(&workers[i].ss);
+		dl_destroy(&workers[i].dl);
+	}
+	if(fclose(fp)) {
+		ERROR("Error writing export file: %s\n", filename);
+		ret = -1;
+	}
+	if(ret == 0) {
+		printf("Exported %d frames using %d threads\n", job.num_frames, num_threads);
+	}
+
+	for(i=0; i < job.num_slots; i++) {
+		free(job.slots[i].data);
+	}
+	free(job.slots);
+	free(workers);
+	free(job.frame_indices);
+	pthread_mutex_destroy(&job.lock);
+	pthread_cond_destroy(&job.cond);
+	return ret;
+}
+
+/* Render thread *******************************************************
+ *
+ * Frames are evaluated and drawn on a separate thread into a triple
+ * buffer of images.  The thread draws into the back buffer and swaps it
+ * with the ready one when it's done; expose swaps the ready buffer with
+ * the front one and just copies it to the window.  Only the latest
+ * request is kept, so the thread never falls behind the main loop. */
+
+typedef struct {
+	draw_ptr image;
+	int width;
+	int height;
+	gint64 seek_start; // from the request
+	int quality; // from the request
+	double render_ms;
+	bool cached; // copied from the frame cache rather than drawn
+	damage_t damage; // what changed since the frame shown before this one
+} render_buffer_t;
+
+typedef struct {
+	int frame_index;
+	int width;
+	int height;
+	range_t x_range;
+	range_t y_range;
+	bool overlay;
+	int quality;
+	gint64 seek_start; // when the seek being drawn was made, 0 if not a seek
+	double seek_latency_ms;
+	int seeks_dropped;
+} render_request_t;
+
+/* Finished frames, so stepping back and forth over the same few frames
+ * doesn't draw them again.  Entries are for one canvas size and view; a
+ * frame for any other clears the cache.  Only best quality frames without
+ * the overlay (whose numbers would go stale) are kept.  The least recently
+ * used frames are dropped to stay within the budget. */
+typedef struct {
+	int frame_index;
+	uint32_t *pixels; // width * height, as from draw_image_get_data()
+	unsigned int last_used;
+} frame_cache_entry_t;
+
+typedef struct {
+	size_t budget; // bytes
+	size_t bytes;
+	int width;
+	int height;
+	range_t x_range;
+	range_t y_range;
+	frame_cache_entry_t *entries;
+	int num_entries;
+	int capacity;
+	unsigned int clock;
+} frame_cache_t;
+
+struct _render_thread_t {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool quit;
+
+	render_request_t request; // the latest request
+	bool pending; // request hasn't been started yet
+	bool idle_pending; // a redraw has been queued with the main loop
+
+	render_buffer_t buffers[3];
+	int back; // being drawn by the thread
+	int ready; // last completed frame
+	int front; // shown by expose
+	bool ready_new; // ready holds a frame expose hasn't seen
+	bool ready_queued; // ready's damage has been invalidated, so expose may show it
+	int seeks_dropped; // requests replaced before the thread got to them
+
+	// only used by the thread
+	scene_state_t ss;
+	dlist_t dl;
+	render_stats_t stats;
+	damage_tracker_t damage;
+	tile_cache_t tiles;
+	sprite_cache_t sprites;
+	frame_cache_t frames;
+};
+
+static void frame_cache_clear(frame_cache_t *fc) {
+	int i;
+	for(i=0; i < fc->num_entries; i++) {
+		free(fc->entries[i].pixels);
+	}
+	fc->num_entries = 0;
+	fc->bytes = 0;
+}
+
+/* Whether the cache can be used for req.  Any request can take a cached
+ * frame (they're all best quality, which does for a fast request too), but
+ * only best quality frames should be stored. */
+static bool frame_cache_usable(frame_cache_t *fc, const render_request_t *req) {
+	if(fc->budget == 0 || req->overlay) {
+		return false;
+	}
+	if(fc->width != req->width || fc->height != req->height ||
+		fc->x_range.min != req->x_range.min || fc->x_range.max != req->x_range.max ||
+		fc->y_range.min != req->y_range.min || fc->y_range.max != req->y_range.max) {
+		frame_cache_clear(fc);
+		fc->width = req->width;
+		fc->height = req->height;
+		fc->x_range = req->x_range;
+		fc->y_range = req->y_range;
+	}
+	return (size_t)fc->width * fc->height * sizeof(uint32_t) <= fc->budget;
+}
+
+/* Copy a cached frame into dp.  Returns false if it isn't there. */
+static bool frame_cache_fetch(frame_cache_t *fc, int frame_index, draw_ptr dp) {
+	int i;
+	for(i=0; i < fc->num_entries; i++) {
+		frame_cache_entry_t *e = &fc->entries[i];
+		if(e->frame_index == frame_index) {
+			e->last_used = ++fc->clock;
+			draw_start(dp);
+			draw_pixels(dp, (unsigned char *)e->pixels, fc->width * sizeof(uint32_t), fc->width, fc->height, 0, 0);
+			draw_finish(dp);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void frame_cache_store(frame_cache_t *fc, int frame_index, draw_ptr dp) {
+	int i, row;
+	size_t size = (size_t)fc->width * fc->height * sizeof(uint32_t);
+	while(fc->num_entries > 0 && fc->bytes + size > fc->budget) {
+		int lru = 0;
+		for(i=1; i < fc->num_entries; i++) {
+			if(fc->entries[i].last_used < fc->entries[lru].last_used) {
+				lru = i;
+			}
+		}
+		free(fc->entries[lru].pixels);
+		fc->entries[lru] = fc->entries[--fc->num_entries];
+		fc->bytes -= size;
+	}
+	if(fc->num_entries == fc->capacity) {
+		fc->entries = array_grow(fc->entries, &fc->capacity, sizeof(fc->entries[0]), "frame cache");
+	}
+	frame_cache_entry_t *e = &fc->entries[fc->num_entries];
+	e->pixels = malloc(size);
+	if(e->pixels == NULL) {
+		return; // just don't cache it
+	}
+	int stride;
+	unsigned char *data = draw_image_get_data(dp, &stride);
+	for(row=0; row < fc->height; row++) {
+		memcpy(e->pixels + (size_t)row * fc->width, data + (size_t)row * stride, fc->width * sizeof(uint32_t));
+	}
+	e->frame_index = frame_index;
+	e->last_used = ++fc->clock;
+	fc->num_entries++;
+	fc->bytes += size;
+}
+
+static gboolean render_thread_done(gpointer data) {
+	render_thread_t *rt = data;
+	pthread_mutex_lock(&rt->lock);
+	rt->idle_pending = false;
+	damage_t damage = rt->buffers[rt->ready].damage;
+	rt->ready_queued = true;
+	pthread_mutex_unlock(&rt->lock);
+	damage_queue(&damage);
+	return FALSE;
+}
+
+static void *render_thread_main(void *arg) {
+	render_thread_t *rt = arg;
+	pthread_mutex_lock(&rt->lock);
+	while(1) {
+		while(!rt->pending && !rt->quit) {
+			pthread_cond_wait(&rt->cond, &rt->lock);
+		}
+		if(rt->quit) {
+			break;
+		}
+		render_request_t req = rt->request;
+		rt->pending = false;
+		rt->request.seek_start = 0;
+		pthread_mutex_unlock(&rt->lock);
+
+		// the back buffer belongs to this thread, so no lock is needed here
+		render_buffer_t *b = &rt->buffers[rt->back];
+		if(b->image == NULL || b->width != req.width || b->height != req.height) {
+			draw_ptr image = draw_create_image(req.width, req.height);
+			if(image == NULL) {
+				// couldn't allocate it (a huge canvas?); skip the frame, so the last one stays up
+				pthread_mutex_lock(&rt->lock);
+				continue;
+			}
+			if(b->image) {
+				draw_destroy(b->image);
+			}
+			b->image = image;
+			b->width = req.width;
+			b->height = req.height;
+		}
+		scene_state_load_frame(&rt->ss, req.frame_index);
+		rt->stats.seek_latency_ms = req.seek_latency_ms;
+		rt->stats.seeks_dropped = req.seeks_dropped;
+		gint64 start = g_get_monotonic_time();
+		bool cacheable = frame_cache_usable(&rt->frames, &req);
+		b->cached = cacheable && frame_cache_fetch(&rt->frames, req.frame_index, b->image);
+		if(!b->cached) {
+			render_frame(b->image, &rt->dl, &rt->ss, req.x_range, req.y_range, req.overlay, req.quality, 
+				&rt->tiles, &rt->sprites, &rt->stats);
+			if(cacheable && req.quality == DRAW_QUALITY_BEST) {
+				frame_cache_store(&rt->frames, req.frame_index, b->image);
+			}
+		}
+		b->seek_start = req.seek_start;
+		b->quality = b->cached ? DRAW_QUALITY_BEST : req.quality;
+		b->render_ms = (g_get_monotonic_time() - start) / 1000.0;
+		rt->stats.frame_ms = b->render_ms; // shows up in the next frame's overlay
+		rt->stats.quality = b->quality;
+
+		view_t view;
+		view_make(&view, req.width, req.height, req.x_range, req.y_range);
+		damage_clear(&b->damage);
+		damage_track(&rt->damage, &rt->ss, &view, req.overlay, b->quality, &b->damage);
+
+		pthread_mutex_lock(&rt->lock);
+		if(rt->ready_new) {
+			// the frame being replaced was never shown, so its changes still count
+			damage_merge(&b->damage, &rt->buffers[rt->ready].damage);
+		}
+		int t = rt->back;
+		rt->back = rt->ready;
+		rt->ready = t;
+		rt->ready_new = true;
+		rt->ready_queued = false;
+		if(!rt->idle_pending) {
+			rt->idle_pending = true;
+			g_idle_add(render_thread_done, rt);
+		}
+	}
+	pthread_mutex_unlock(&rt->lock);
+	return NULL;
+}
+
+/* Queue the current request; called with the lock held. */
+static void render_thread_post(render_thread_t *rt) {
+	if(rt->request.width <= 0 || rt->request.height <= 0) {
+		return; // not exposed yet
+	}
+	rt->request.x_range = app_data.x_range;
+	rt->request.y_range = app_data.y_range;
+	rt->request.overlay = app_data.gui.show_overlay;
+	rt->request.quality = app_data.gui.quality;
+	rt->request.seek_latency_ms = app_data.gui.stats.seek_latency_ms;
+	rt->request.seeks_dropped = app_data.gui.stats.seeks_dropped;
+	rt->pending = true;
+	pthread_cond_signal(&rt->cond);
+}
+
+static void render_thread_seek(render_thread_t *rt, int frame_index, gint64 seek_start) {
+	pthread_mutex_lock(&rt->lock);
+	// only count seeks; playback ticks being skipped isn't news
+	if(rt->pending && rt->request.seek_start != 0 && rt->request.frame_index != frame_index) {
+		rt->seeks_dropped++;
+	}
+	rt->request.frame_index = frame_index;
+	if(rt->request.seek_start == 0) {
+		rt->request.seek_start = seek_start;
+	}
+	render_thread_post(rt);
+	pthread_mutex_unlock(&rt->lock);
+}
+
+/* Redraw the current frame, after the view changed. */
+static void render_thread_refresh(render_thread_t *rt) {
+	pthread_mutex_lock(&rt->lock);
+	render_thread_post(rt);
+	pthread_mutex_unlock(&rt->lock);
+}
+
+static void render_thread_resize(render_thread_t *rt, int width, int height) {
+	pthread_mutex_lock(&rt->lock);
+	if(rt->request.width != width || rt->request.height != height) {
+		rt->request.width = width;
+		rt->request.height = height;
+		render_thread_post(rt);
+	}
+	pthread_mutex_unlock(&rt->lock);
+}
+
+/* Copy the latest completed frame to dp (from expose). */
+static void render_thread_show(render_thread_t *rt, draw_ptr dp) {
+	pthread_mutex_lock(&rt->lock);
+	bool swapped = false;
+	if(rt->ready_new && rt->ready_queued) {
+		int t = rt->front;
+		rt->front = rt->ready;
+		rt->ready = t;
+		rt->ready_new = false;
+		swapped = true;
+	}
+	app_data.gui.stats.seeks_dropped += rt->seeks_dropped;
+	rt->seeks_dropped = 0;
+	pthread_mutex_unlock(&rt->lock);
+
+	// the front buffer is only touched by the main thread
+	render_buffer_t *b = &rt->buffers[rt->front];
+	if(swapped && !b->cached) {
+		quality_frame_drawn(b->quality, b->render_ms);
+	}
+	if(b->image) {
+		int stride;
+		unsigned char *data = draw_image_get_data(b->image, &stride);
+		draw_pixels(dp, data, stride, b->width, b->height, 0, 0);
+	}
+	if(b->seek_start) {
+		app_data.gui.stats.seek_latency_ms = (g_get_monotonic_time() - b->seek_start) / 1000.0;
+		b->seek_start = 0;
+	}
+}
+
+/* Returns NULL if the backend can't draw offscreen, in which case frames
+ * are drawn in the main loop as before. */
+static render_thread_t *render_thread_start(size_t frame_cache_bytes) {
+	draw_ptr probe = draw_create_image(1, 1);
+	if(probe == NULL) {
+		return NULL;
+	}
+	draw_destroy(probe);
+
+	render_thread_t *rt = calloc(1, sizeof(render_thread_t));
+	if(rt == NULL) {
+		ERROR("Error allocating render thread\n");
+		exit(-1);
+	}
+	pthread_mutex_init(&rt->lock, NULL);
+	pthread_cond_init(&rt->cond, NULL);
+	rt->back = 0;
+	rt->ready = 1;
+	rt->front = 2;
+	rt->request.frame_index = app_data.active_frame_index;
+	scene_state_clone(&rt->ss, &app_data.scene);
+	dl_init(&rt->dl);
+	tile_cache_init(&rt->tiles);
+	sprite_cache_init(&rt->sprites);
+	rt->frames.budget = frame_cache_bytes;
+	if(pthread_create(&rt->thread, NULL, render_thread_main, rt)) {
+		ERROR("Error creating render thread\n");
+		exit(-1);
+	}
+	return rt;
+}
+
+static void render_thread_stop(render_thread_t *rt) {
+	int i;
+	if(rt == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&rt->lock);
+	rt->quit = true;
+	pthread_cond_signal(&rt->cond);
+	pthread_mutex_unlock(&rt->lock);
+	pthread_join(rt->thread, NULL);
+
+	// tiles were drawn with one of the buffers, which any of them can free
+	tile_cache_free(&rt->tiles, rt->buffers[rt->back].image);
+	sprite_cache_free(&rt->sprites);
+	frame_cache_clear(&rt->frames);
+	free(rt->frames.entries);
+	for(i=0; i < 3; i++) {
+		if(rt->buffers[i].image) {
+			draw_destroy(rt->buffers[i].image);
+		}
+	}
+	scene_state_free(&rt->ss);
+	dl_destroy(&rt->dl);
+	damage_tracker_free(&rt->damage);
+	pthread_mutex_destroy(&rt->lock);
+	pthread_cond_destroy(&rt->cond);
+	free(rt);
+}
+
+/* Filmstrip **********************************************************
+ *
+ * The thumbnails are drawn offscreen by a couple of worker threads at the
+ * lowest CPU priority, so they only use time playback doesn't need.  They
+ * are handed out in order of halving spacing (first and middle frames,
+ * then the quarters, ...) and a slot whose thumbnail isn't ready shows the
+ * nearest one that is, so the strip starts coarse and fills in.
+ */
+
+#define FILMSTRIP_HEIGHT_PX 48
+#define FILMSTRIP_THUMBS 64
+#define FILMSTRIP_THREADS 2
+
+struct _filmstrip_worker_t {
+	filmstrip_t *fs;
+	pthread_t thread;
+	draw_ptr dp;
+	scene_state_t ss;
+	dlist_t dl;
+	render_stats_t stats;
+};
+
+static void filmstrip_render(filmstrip_worker_t *w, thumb_t *t) {
+	filmstrip_t *fs = w->fs;
+	scene_state_load_frame(&w->ss, t->frame_index);
+	draw_start(w->dp);
+	view_t view;
+	view_make(&view, fs->width, fs->height, app_data.home_x_range, app_data.home_y_range);
+	view.lod_scale = 0; // the level of detail cache isn't ours to touch
+	dl_clear(&w->dl);
+	render_static(&w->dl, &view, &w->stats);
+	render_scene(&w->dl, &w->ss, &view, DRAW_QUALITY_BEST, NULL, &w->stats);
+	dl_sort_by_state(&w->dl);
+	draw_set_quality(w->dp, DRAW_QUALITY_BEST);
+	dl_replay(&w->dl, w->dp);
+	draw_finish(w->dp);
+
+	int stride, row;
+	unsigned char *data = draw_image_get_data(w->dp, &stride);
+	for(row=0; row < fs->height; row++) {
+		memcpy(t->pixels + (size_t)row * fs->width, data + (size_t)row * stride, fs->width * sizeof(uint32_t));
+	}
+}
+
+static gboolean filmstrip_done(gpointer data) {
+	filmstrip_t *fs = data;
+	pthread_mutex_lock(&fs->lock);
+	fs->redraw_pending = false;
+	pthread_mutex_unlock(&fs->lock);
+	gtk_widget_queue_draw(fs->widget);
+	return FALSE;
+}
+
+static void *filmstrip_worker_main(void *data) {
+	filmstrip_worker_t *w = data;
+	filmstrip_t *fs = w->fs;
+
+	// on Linux the nice value is per thread, so this leaves the rest of the process alone
+	setpriority(PRIO_PROCESS, 0, 19);
+
+	pthread_mutex_lock(&fs->lock);
+	while(!fs->quit && fs->next_job < fs->num_thumbs) {
+		thumb_t *t = &fs->thumbs[fs->order[fs->next_job++]];
+		pthread_mutex_unlock(&fs->lock);
+
+		filmstrip_render(w, t);
+
+		pthread_mutex_lock(&fs->lock);
+		t->ready = true;
+		if(!fs->redraw_pending) {
+			fs->redraw_pending = true;
+			g_idle_add_full(G_PRIORITY_LOW, filmstrip_done, fs, NULL);
+		}
+	}
+	pthread_mutex_unlock(&fs->lock);
+	return NULL;
+}
+
+/* The ready thumbnail nearest to position f (0 to 1) along the strip, or
+ * NULL if none is.  Called with the lock held. */
+static thumb_t *filmstrip_nearest(filmstrip_t *fs, double f) {
+	int i;
+	thumb_t *best = NULL;
+	double best_d = INFINITY;
+	for(i=0; i < fs->num_thumbs; i++) {
+		double d = fabs((i + 0.5) / fs->num_thumbs - f);
+		if(fs->thumbs[i].ready && d < best_d) {
+			best = &fs->thumbs[i];
+			best_d = d;
+		}
+	}
+	return best;
+}
+
+static gboolean filmstrip_expose(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
+	filmstrip_t *fs = data;
+	int i;
+	float width, height;
+	draw_start(fs->drawer);
+	draw_get_canvas_dims(fs->drawer, &width, &height);
+	draw_set_color(fs->drawer, 0.2, 0.2, 0.2);
+	draw_rectangle_filled(fs->drawer, 0, 0, width, height);
+
+	int slots = width / fs->width;
+	if(slots < 1) {
+		slots = 1;
+	}
+	float slot_w = width / slots;
+	pthread_mutex_lock(&fs->lock);
+	for(i=0; i < slots; i++) {
+		thumb_t *t = filmstrip_nearest(fs, (i + 0.5) / slots);
+		if(t != NULL) {
+			draw_pixels(fs->drawer, (unsigned char *)t->pixels, fs->width * sizeof(uint32_t), fs->width, fs->height,
+				floor(i * slot_w + (slot_w - fs->width) / 2), floor((height - fs->height) / 2));
+		}
+	}
+	pthread_mutex_unlock(&fs->lock);
+	draw_finish(fs->drawer);
+	return TRUE;
+}
+
+/* Create the strip's widget, or leave fs->widget NULL if there's nothing
+ * to show or the backend can't draw offscreen. */
+static void filmstrip_init(filmstrip_t *fs) {
+	int i, k, step;
+	memset(fs, 0, sizeof(*fs));
+	if(app_data.follow) {
+		return; // the thumbnails would be spaced over the frames there were at the start
+	}
+	draw_ptr probe = draw_create_image(1, 1);
+	if(probe == NULL || app_data.num_frames < 2) {
+		if(probe) {
+			draw_destroy(probe);
+		}
+		return;
+	}
+	draw_destroy(probe);
+
+	// thumbnails have the shape of the initial view
+	double aspect = (app_data.home_x_range.max - app_data.home_x_range.min) / 
+		(app_data.home_y_range.max - app_data.home_y_range.min);
+	fs->height = FILMSTRIP_HEIGHT_PX;
+	fs->width = CLAMP((int)round(fs->height * aspect), FILMSTRIP_HEIGHT_PX / 2, 3 * FILMSTRIP_HEIGHT_PX);
+
+	fs->num_thumbs = MIN(FILMSTRIP_THUMBS, app_data.num_frames);
+	fs->thumbs = calloc(fs->num_thumbs, sizeof(fs->thumbs[0]));
+	fs->order = malloc(fs->num_thumbs * sizeof(fs->order[0]));
+	if(fs->thumbs == NULL || fs->order == NULL) {
+		ERROR("Error allocating filmstrip\n");
+		exit(-1);
+	}
+	for(i=0; i < fs->num_thumbs; i++) {
+		thumb_t *t = &fs->thumbs[i];
+		// the slider maps its position linearly to the frame index
+		t->frame_index = (int)((i + 0.5) / fs->num_thumbs * app_data.num_frames);
+		t->ready = false;
+		t->pixels = malloc((size_t)fs->width * fs->height * sizeof(uint32_t));
+		if(t->pixels == NULL) {
+			ERROR("Error allocating filmstrip\n");
+			exit(-1);
 		}
-		update_body_transforms();
-		gtk_widget_queue_draw(app_data.gui.canvas);
-		return FALSE;
 	}
-
-	if(app_data.paused) {
-		return TRUE;
+	// halve the spacing each round, skipping thumbnails already queued
+	bool *queued = calloc(fs->num_thumbs, sizeof(bool));
+	int n = 0;
+	for(step=1; step < fs->num_thumbs; step *= 2);
+	for(; step >= 1; step /= 2) {
+		for(k=0; k < fs->num_thumbs; k += step) {
+			if(!queued[k]) {
+				queued[k] = true;
+				fs->order[n++] = k;
+			}
+		}
 	}
+	free(queued);
+	pthread_mutex_init(&fs->lock, NULL);
 
-	update_bodies();
+	fs->widget = gtk_drawing_area_new();
+	gtk_widget_set_size_request(fs->widget, -1, FILMSTRIP_HEIGHT_PX);
+	g_signal_connect(fs->widget, "expose_event", G_CALLBACK(filmstrip_expose), fs);
+	fs->drawer = draw_create(fs->widget);
+}
 
-	// set the slider value
-	if(app_data.explicit_time) {
-		app_data.time = 
-			get_time_from_frame(app_data.frames[app_data.active_frame_index]);
-	} else {
-		app_data.time = app_data.dt * app_data.active_frame_index;
+static void filmstrip_start(filmstrip_t *fs) {
+	int i;
+	if(fs->widget == NULL) {
+		return;
 	}
-	gtk_range_set_value((GtkRange *)app_data.gui.slider, app_data.time);
-	char str[50];
-	sprintf(str, "t=%g", app_data.time);
-	gtk_label_set_text((GtkLabel*)app_data.gui.time, str);
-
-	// request a redraw of the canvas, which will redraw everything
-	gtk_widget_queue_draw(app_data.gui.canvas);
-
-	// advance frame counter
-	// If we get to the end (last frame), start over at the beginning
-	app_data.active_frame_index++;
-	if(app_data.active_frame_index >= app_data.num_frames) {
-		//app_data.active_frame_index = app_data.num_frames - 1;
-		app_data.active_frame_index = 0;
+	fs->num_workers = FILMSTRIP_THREADS;
+	fs->workers = calloc(fs->num_workers, sizeof(fs->workers[0]));
+	if(fs->workers == NULL) {
+		ERROR("Error allocating filmstrip\n");
+		exit(-1);
+	}
+	for(i=0; i < fs->num_workers; i++) {
+		filmstrip_worker_t *w = &fs->workers[i];
+		w->fs = fs;
+		w->dp = draw_create_image(fs->width, fs->height);
+		scene_state_clone(&w->ss, &app_data.scene);
+		dl_init(&w->dl);
+		if(pthread_create(&w->thread, NULL, filmstrip_worker_main, w)) {
+			ERROR("Error starting filmstrip thread\n");
+			exit(-1);
+		}
 	}
-
-	return TRUE;
 }
 
-void button_activate(GtkButton *b, gpointer data) {
-	app_data.paused = !app_data.paused;
-	if(app_data.paused) {
-		GtkWidget *im = gtk_button_get_image(b);
-		gtk_image_set_from_stock(
-			(GtkImage *)im, 
-			GTK_STOCK_MEDIA_PLAY, 
-			GTK_ICON_SIZE_SMALL_TOOLBAR
-		);
+static void filmstrip_stop(filmstrip_t *fs) {
+	int i;
+	if(fs->widget == NULL) {
+		return;
 	}
-	else {
-		GtkWidget *im = gtk_button_get_image(b);
-		gtk_image_set_from_stock(
-			(GtkImage *)im, 
-			GTK_STOCK_MEDIA_PAUSE, 
-			GTK_ICON_SIZE_SMALL_TOOLBAR
-		);
+	pthread_mutex_lock(&fs->lock);
+	fs->quit = true;
+	pthread_mutex_unlock(&fs->lock);
+	for(i=0; i < fs->num_workers; i++) {
+		filmstrip_worker_t *w = &fs->workers[i];
+		pthread_join(w->thread, NULL);
+		draw_destroy(w->dp);
+		scene_state_free(&w->ss);
+		dl_destroy(&w->dl);
 	}
-	return;
+	free(fs->workers);
+	for(i=0; i < fs->num_thumbs; i++) {
+		free(fs->thumbs[i].pixels);
+	}
+	free(fs->thumbs);
+	free(fs->order);
+	pthread_mutex_destroy(&fs->lock);
 }
 
-void slider_changed_cb(GtkRange *range, gpointer  user_data) {
-	//printf("slider changed!\n");
+static void slider_add_marks(GtkScale *slider) {
+	char str[20];
+	snprintf(str, sizeof(str), "%g", app_data.t_min);
+	gtk_scale_add_mark(slider, app_data.t_min, GTK_POS_BOTTOM, str);
+	snprintf(str, sizeof(str), "%g", app_data.t_max);
+	gtk_scale_add_mark(slider, app_data.t_max, GTK_POS_BOTTOM, str);
 }
 
-gboolean slider_changed2_cb (
-		GtkRange *range,
-		GtkScrollType scroll,
-		gdouble value, 
-		gpointer user_data) 
-{
-	//printf("slider changed 2!\n");
+#define FOLLOW_POLL_MS 100
 
-	// if NOT paused, prevent user from moving the slider
-	if(!app_data.paused) {
+/* Append the frames written to the datafile since the last poll. */
+static gboolean follow_poll_cb(gpointer data) {
+	gui_t *gp = &app_data.gui;
+	int old_num_frames = app_data.num_frames;
+	data_reader_read(&app_data.reader);
+	if(app_data.num_frames == old_num_frames) {
 		return TRUE;
 	}
-
-	// Otherwise (we must be paused)
-	//printf("scroll type: %d\n", scroll);
-	switch(scroll) {
-	case GTK_SCROLL_JUMP:
-		// set the active frame index and time based on slider position
-		if(app_data.explicit_time) {
-			int frame_index = (value - app_data.t_min)/(app_data.t_max - app_data.t_min) * app_data.num_frames;
-			if (frame_index < 0)
-				frame_index = 0;
-			else if( frame_index >= app_data.num_frames)
-				frame_index = app_data.num_frames - 1;
-			double t = get_time_from_frame(app_data.frames[frame_index]);
-			double delta= fabs(t - value);
-			if(t < value) {
-				while(1) {
-					if( (frame_index+1) >= app_data.num_frames) {
-						break;
-					}
-					double t_next = get_time_from_frame(app_data.frames[frame_index + 1]);
-					double delta_next = fabs(t_next - value);
-					if(delta_next > delta) {
-						break;
-					}
-					t = t_next;
-					delta = delta_next;
-					frame_index++;
-				}
-			}
-			else if(t > value) {
-				while(t > value) {
-					if(frame_index <= 0) {
-						break;
-					}
-					double t_next = get_time_from_frame(app_data.frames[frame_index - 1]);
-					double delta_next = fabs(t_next - value);
-					if(delta_next > delta) {
-						break;
-					}
-					t = t_next;
-					delta = delta_next;
-					frame_index--;
-				}
-			}
-			app_data.active_frame_index = frame_index;
-			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
-		}
-		else {
-			int frame_index = (value - app_data.t_min)/(app_data.t_max - app_data.t_min) * app_data.num_frames;
-			if (frame_index < 0)
-				frame_index = 0;
-			else if( frame_index >= app_data.num_frames)
-				frame_index = app_data.num_frames - 1;
-			app_data.active_frame_index = frame_index;
-			gtk_range_set_value((GtkRange *)app_data.gui.slider, app_data.active_frame_index * app_data.dt);
-		}
-		break;
-	case GTK_SCROLL_STEP_FORWARD:
-		{
-			app_data.active_frame_index++;
-			if(app_data.active_frame_index >= app_data.num_frames) {
-				app_data.active_frame_index = app_data.num_frames - 1;
-			}
-			double t;
-			if(app_data.explicit_time) {
-				t = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
-			} else {
-				t = app_data.active_frame_index * app_data.dt;
-			}
-			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
-			break;
-		}
-	case GTK_SCROLL_STEP_BACKWARD:
-		{
-			app_data.active_frame_index--;
-			if(app_data.active_frame_index < 0) {
-				app_data.active_frame_index = 0;
-			}
-			double t;
-			if(app_data.explicit_time) {
-				t = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
-			} else {
-				t = app_data.active_frame_index * app_data.dt;
-			}
-			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
-			break;
-		}
-	case GTK_SCROLL_PAGE_FORWARD:
-		{
-			app_data.active_frame_index += 10;
-			if(app_data.active_frame_index >= app_data.num_frames) {
-				app_data.active_frame_index = app_data.num_frames - 1;
-			}
-			double t;
-			if(app_data.explicit_time) {
-				t = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
-			} else {
-				t = app_data.active_frame_index * app_data.dt;
-			}
-			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
-			break;
-		}
-	case GTK_SCROLL_PAGE_BACKWARD:
-		{
-			app_data.active_frame_index -= 10;
-			if(app_data.active_frame_index < 0) {
-				app_data.active_frame_index = 0;
-			}
-			double t;
-			if(app_data.explicit_time) {
-				t = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
-			} else {
-				t = app_data.active_frame_index * app_data.dt;
-			}
-			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
-			break;
-		}
-	case GTK_SCROLL_START:
-		{
-			app_data.active_frame_index = 0;
-			double t;
-			if(app_data.explicit_time) {
-				t = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
-			} else {
-				t = app_data.active_frame_index * app_data.dt;
-			}
-			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
-			break;
-		}
-	case GTK_SCROLL_END:
-		{
-			app_data.active_frame_index = app_data.num_frames - 1;
-			double t;
-			if(app_data.explicit_time) {
-				t = get_time_from_frame(app_data.frames[app_data.active_frame_index]);
-			} else {
-				t = app_data.active_frame_index * app_data.dt;
-			}
-			gtk_range_set_value((GtkRange *)app_data.gui.slider, t);
-			break;
-		}
-	default:
-		return TRUE;
+	if(!app_data.explicit_time) {
+		app_data.t_max = (app_data.num_frames - 1) * app_data.dt;
 	}
-	update_bodies();
-	gtk_widget_queue_draw(app_data.gui.canvas);
-	char str[50];
-	sprintf(str, "t=%g", app_data.time);
-	gtk_label_set_text((GtkLabel*)app_data.gui.time, str);
-
+	gtk_range_set_range((GtkRange *)gp->slider, app_data.t_min, app_data.t_max);
+	gtk_scale_clear_marks((GtkScale *)gp->slider);
+	slider_add_marks((GtkScale *)gp->slider);
+	#if USE_PLOTS
+	plots_append();
+	#endif
 	return TRUE;
 }
 
-
 void init_gui(void) {
 	GtkWidget *window;
 	GtkWidget *v_box;
@@ -1989,6 +5367,9 @@ void init_gui(void) {
 	GtkWidget *button;
 	gui_t *gp = &(app_data.gui);
 
+	#if !GLIB_CHECK_VERSION(2,32,0)
+	g_thread_init(NULL);
+	#endif
 	gtk_init (NULL, NULL);
 
 	window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
@@ -1999,6 +5380,14 @@ void init_gui(void) {
 	gp->canvas = gtk_drawing_area_new();
 	gtk_widget_set_size_request(gp->canvas, 500,400);
 	g_signal_connect(gp->canvas, "expose_event", G_CALLBACK(draw_canvas), NULL);
+	gtk_widget_add_events(gp->canvas, 
+		GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK | GDK_POINTER_MOTION_MASK | GDK_SCROLL_MASK);
+	g_signal_connect(gp->canvas, "scroll-event", G_CALLBACK(canvas_scroll_cb), NULL);
+	g_signal_connect(gp->canvas, "button-press-event", G_CALLBACK(canvas_button_press_cb), NULL);
+	g_signal_connect(gp->canvas, "motion-notify-event", G_CALLBACK(canvas_motion_cb), NULL);
+	g_signal_connect(gp->canvas, "button-release-event", G_CALLBACK(canvas_button_release_cb), NULL);
+	app_data.home_x_range = app_data.x_range;
+	app_data.home_y_range = app_data.y_range;
 
 #if USE_PLOTS
 	gp->h_pane = gtk_hpaned_new();
@@ -2016,14 +5405,24 @@ void init_gui(void) {
 	GtkWidget *plot_v_box = gtk_vbox_new(FALSE, 4);
    gtk_scrolled_window_add_with_viewport(GTK_SCROLLED_WINDOW(gp->plot_win), plot_v_box);
 
- 	GtkWidget *g_plot = jbplot_new();
-   gtk_box_pack_start(GTK_BOX(plot_v_box), g_plot, TRUE, TRUE, 0);
+	plots_init(plot_v_box);
 
 #else
 	gtk_box_pack_start (GTK_BOX(v_box), gp->canvas, TRUE, TRUE, 0);
 #endif
 
 	gp->drawer = draw_create(gp->canvas);
+	dl_init(&gp->dlist);
+	gp->dlist_valid = false;
+	gp->quality = DRAW_QUALITY_BEST;
+	gp->best_frame_ms = 0;
+	gp->quality_timeout = 0;
+	dl_init(&gp->bg_dlist);
+	gp->bg_valid = false;
+	tile_cache_init(&gp->tiles);
+	sprite_cache_init(&gp->sprites);
+	gp->tiles_idle = 0;
+	gp->dragging = false;
 
 	vcr_hbox = gtk_hbox_new(FALSE, 10);
 	GtkWidget *button_v_box = gtk_vbox_new(FALSE, 10);
@@ -2048,23 +5447,15 @@ void init_gui(void) {
 		gtk_scale_set_draw_value((GtkScale *)gp->slider, FALSE);
 		//g_signal_connect(gp->slider, "value-changed", G_CALLBACK(slider_changed_cb), NULL);
 		g_signal_connect(gp->slider, "change-value", G_CALLBACK(slider_changed2_cb), NULL);
-		char str[20];
-		snprintf(str, sizeof(str), "%g", app_data.t_min);
-		gtk_scale_add_mark(
-			(GtkScale *)gp->slider,
-			app_data.t_min,
-			GTK_POS_BOTTOM,
-			str
-		);
-		snprintf(str, sizeof(str), "%g", app_data.t_max);
-		gtk_scale_add_mark(
-			(GtkScale *)gp->slider,
-			app_data.t_max,
-			GTK_POS_BOTTOM,
-			str
-		);
+		slider_add_marks((GtkScale *)gp->slider);
 		gtk_scale_set_digits((GtkScale *)gp->slider, 5);
-		gtk_box_pack_start (GTK_BOX(vcr_hbox), gp->slider, TRUE, TRUE, 0);
+		GtkWidget *slider_v_box = gtk_vbox_new(FALSE, 2);
+		gtk_box_pack_start (GTK_BOX(vcr_hbox), slider_v_box, TRUE, TRUE, 0);
+		gtk_box_pack_start (GTK_BOX(slider_v_box), gp->slider, FALSE, FALSE, 0);
+		filmstrip_init(&gp->filmstrip);
+		if(gp->filmstrip.widget) {
+			gtk_box_pack_start (GTK_BOX(slider_v_box), gp->filmstrip.widget, FALSE, FALSE, 0);
+		}
 		gtk_range_set_value((GtkRange *)gp->slider, 0.05);
 	}
 
@@ -2079,6 +5470,9 @@ void init_gui(void) {
 	g_signal_connect (window, "destroy", G_CALLBACK (gtk_main_quit), NULL);
 	gtk_widget_show_all (window);
 	g_timeout_add(30, update_func, NULL);
+	if(app_data.follow) {
+		g_timeout_add(FOLLOW_POLL_MS, follow_poll_cb, NULL);
+	}
 }
 
 #define MAX_FIELDS 30
@@ -2091,7 +5485,21 @@ int main(int argc, char *argv[]) {
 		return 0;
 	}
 
+	/* When the video goes to stdout, keep the stream clean by sending
+	 * everything else printed there to stderr instead. */
+	FILE *export_fp = NULL;
+	if(args.export_given && !strcmp(args.export_arg, "-")) {
+		export_fp = fdopen(dup(STDOUT_FILENO), "wb");
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+		if(export_fp == NULL) {
+			ERROR("Error opening stdout for export\n");
+			exit(-1);
+		}
+	}
+
 	app_data_init(&app_data);
+	app_data.gui.show_overlay = args.overlay_flag;
+	app_data.plot_window = args.plot_window_arg;
 
 	/* this initializes the library and check potential ABI mismatches
 	 * between the version it was compiled for and the actual shared
@@ -2109,6 +5517,9 @@ int main(int argc, char *argv[]) {
 	//print_all_nodes(root, 0);
 	parse_config_xml(root);
 	xmlFreeDoc(doc);
+	scatter_plan_compile(&app_data.plan);
+	body_motion_compile();
+	trail_chain_compile();
 
 	int i;
 	for(i=0; i<app_data.num_bodies; i++) {
@@ -2122,7 +5533,12 @@ int main(int argc, char *argv[]) {
 	FILE *fp;
 	if(args.inputs_num > 1) {
 		infile = args.inputs[1];
+		app_data.follow = args.follow_flag;
 		if(!strcmp(infile, "-")) {
+			if(app_data.follow) {
+				ERROR("--follow needs a datafile, not stdin\n");
+				exit(-1);
+			}
 			fp = stdin;
 		} else {
 			fp = fopen(infile, "r");
@@ -2131,80 +5547,37 @@ int main(int argc, char *argv[]) {
 				exit(-1);
 			}
 		}
-		char line[2000];
-		unsigned int line_num = 0;
-		while(fgets(line, sizeof(line), fp) != NULL) {
-			//printf("got line (%d chars long): %s\n", (int)strlen(line), line);
-			line_num++;
-			//printf("here %d\n", line_num);
-			int i;
-			char *fields[MAX_FIELDS];
-
-
-			int field_count = split_line_into_fields(line, fields, MAX_FIELDS);
-			if(field_count < 0) {
-				continue;
-			}
-
-			frame_ptr_t pframe = frame_alloc(app_data.bytes_per_frame);
-			int offset = 0;
-			for(i=0; i < app_data.num_input_maps; i++) {
-				input_map_t *map = app_data.input_maps[i];
-				if(map->field_num > field_count) {
-					ERROR("Not enough fields!!\n");
-					exit(-1);
-				}
-				int field_index = map->field_num - 1;
-				switch(map->data_type) {
-					case DATA_TYPE_DOUBLE: {
-						double d;
-						if(parse_double(fields[field_index], &d)) {
-							ERROR("Error parsing double from field (\"%s\")\n", fields[field_index]);
-							ERROR("line: %s\n", line);
-							exit(-1);
-						}
-						//printf("input_map #%d: column=%d, type=double, value=%g\n", i+1, map->field_num, d);
-						*((double *)(&pframe[offset])) = d;
-						map->frame_byte_offset = offset;
-						offset += sizeof(double);
-
-						// ensure that timestamp is monotonic, and keep track of min/max timestamps
-						if(i == app_data.time_map_index) {
-							if(app_data.num_frames == 0) { // first frame
-								app_data.t_min = d;
-								app_data.t_max = d;
-							}
-							else if(d < app_data.t_max) {
-								ERROR("Non-monotonic timestamp detected!!!\n");
-								exit(-1);
-							}
-							else {
-								app_data.t_max = d;
-							}
-						}
-						break;
-					}
-					default:
-						ERROR("Unknown data type!\n");
-				}
-			}
-			if(app_data.num_frames >= app_data.frames_capacity) {
-				app_data.frames_capacity *= 3;
-				app_data.frames = realloc(app_data.frames, app_data.frames_capacity * sizeof(app_data.frames[0]));
-				if(app_data.frames == NULL) {
-					ERROR("Error expanding size of 'frames'.\n");
-					exit(-1);
-				}
+		// size the field array to the highest column any <map> refers to
+		int max_fields = MAX_FIELDS;
+		for(i=0; i < app_data.num_input_maps; i++) {
+			if(app_data.input_maps[i]->field_num > max_fields) {
+				max_fields = app_data.input_maps[i]->field_num;
 			}
-			app_data.frames[app_data.num_frames++] = pframe;
-		
 		}
-
-		if(!feof(fp)) {
-			ERROR("Error while reading datafile!!\n");
+		char **fields = malloc(max_fields * sizeof(fields[0]));
+		if(fields == NULL) {
+			ERROR("Error allocating field array\n");
 			exit(-1);
 		}
 
+		app_data.reader.fp = fp;
+		app_data.reader.follow = app_data.follow;
+		app_data.reader.fields = fields;
+		app_data.reader.max_fields = max_fields;
+		app_data.reader.line = NULL;
+		app_data.reader.line_capacity = 0;
+		app_data.reader.line_num = 0;
+		data_reader_read(&app_data.reader);
+		if(app_data.follow) {
+			// the slider needs two frames to span
+			while(app_data.num_frames < 2) {
+				usleep(FOLLOW_POLL_MS * 1000);
+				data_reader_read(&app_data.reader);
+			}
+		} else {
+			free(app_data.reader.line);
+			free(fields);
+		}
 	}
 		printf("Got %d frames\n", app_data.num_frames);
 		app_data.active_frame_index = 0;
@@ -2221,8 +5594,40 @@ int main(int argc, char *argv[]) {
 		app_data.t_max = (app_data.num_frames - 1) * app_data.dt;
 	}
 
+	if(args.render_out_given || args.export_given) {
+		int width, height;
+		if(parse_size(args.size_arg, &width, &height)) {
+			ERROR("Invalid --size \"%s\", expected WIDTHxHEIGHT\n", args.size_arg);
+			exit(-1);
+		}
+		if(args.stride_arg < 1) {
+			ERROR("--stride must be at least 1\n");
+			exit(-1);
+		}
+		double t_start = args.t_start_given ? args.t_start_arg : -INFINITY;
+		double t_end = args.t_end_given ? args.t_end_arg : INFINITY;
+		if(args.export_given) {
+			export_format_enum format = strcmp(args.export_format_arg, "ppm") ? EXPORT_Y4M : EXPORT_PPM;
+			FILE *fp = export_fp ? export_fp : fopen(args.export_arg, "wb");
+			if(fp == NULL) {
+				ERROR("Error opening export file: %s\n", args.export_arg);
+				exit(-1);
+			}
+			return export_video(fp, args.export_arg, format, width, height, args.fps_arg, args.threads_arg,
+				args.stride_arg, t_start, t_end) ? -1 : 0;
+		}
+		return render_out(args.render_out_arg, width, height, args.stride_arg, t_start, t_end) ? -1 : 0;
+	}
+
 	init_gui();
+	if(!args.sync_render_flag) {
+		size_t frame_cache_bytes = (args.frame_cache_arg > 0) ? (size_t)args.frame_cache_arg << 20 : 0;
+		app_data.gui.render_thread = render_thread_start(frame_cache_bytes);
+	}
+	filmstrip_start(&app_data.gui.filmstrip);
 	gtk_main();
+	filmstrip_stop(&app_data.gui.filmstrip);
+	render_thread_stop(app_data.gui.render_thread);
 
 	return 0;
 }